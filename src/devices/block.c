@@ -3,7 +3,27 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Requests to a device wait in its queue, sorted by sector, for
+   the device's queue thread, which serves them in one sweep
+   across the disk after another (C-LOOK), so that swap and file
+   system traffic mix in disk order rather than arrival order.  A
+   request that has waited longer than DEADLINE ticks is served
+   next regardless.  Queued requests in the same direction that
+   continue one another are sent to the driver as one.
+
+   Partitions have no queue of their own: their requests are
+   mapped onto the underlying device's. */
+
+/* Ticks a request may wait before it jumps the sweep. */
+#define DEADLINE (TIMER_FREQ / 2)
+
+/* Most buffers sent to a driver in one merged request. */
+#define MERGE_IOV_MAX 32
 
 /* A block device. */
 struct block
@@ -19,6 +39,13 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+    int64_t io_ticks;                   /* Timer ticks spent in driver. */
+
+    struct lock queue_lock;             /* Guards the members below. */
+    struct condition queue_cond;        /* Signaled when queue not empty. */
+    struct list queue;                  /* Waiting requests, by sector. */
+    block_sector_t head;                /* Sector after the last served. */
+    bool has_thread;                    /* Queue thread started? */
   };
 
 /* List of all block devices. */
@@ -28,6 +55,7 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static thread_func queue_thread;
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -113,6 +141,97 @@ check_sector (struct block *block, block_sector_t sector)
     }
 }
 
+/* Returns the number of sectors covered by the IOV_CNT buffers in
+   IOV, after checking that they all lie within BLOCK when
+   starting at SECTOR. */
+static block_sector_t
+check_iovec (struct block *block, block_sector_t sector,
+             const struct block_iovec *iov, size_t iov_cnt)
+{
+  block_sector_t cnt = 0;
+  size_t i;
+
+  for (i = 0; i < iov_cnt; i++)
+    cnt += iov[i].cnt;
+  if (cnt > 0)
+    check_sector (block, sector + cnt - 1);
+  return cnt;
+}
+
+/* Queues request R for BLOCK and returns at once.  R's DONE
+   function is called when the transfer is complete. */
+void
+block_submit (struct block *block, struct block_request *r)
+{
+  struct list_elem *e;
+
+  /* Check and count the request against BLOCK and each device
+     under it. */
+  r->origin = block;
+  for (;;)
+    {
+      r->cnt = check_iovec (block, r->sector, r->iov, r->iov_cnt);
+      if (r->write)
+        {
+          ASSERT (block->type != BLOCK_FOREIGN);
+          block->write_cnt += r->cnt;
+        }
+      else
+        block->read_cnt += r->cnt;
+      if (block->ops->map == NULL)
+        break;
+      block = block->ops->map (block->aux, &r->sector);
+    }
+  if (r->cnt == 0)
+    {
+      r->done (r->aux);
+      return;
+    }
+  r->deadline = timer_ticks () + DEADLINE;
+
+  lock_acquire (&block->queue_lock);
+  if (!block->has_thread)
+    {
+      thread_create (block->name, PRI_MAX, queue_thread, block);
+      block->has_thread = true;
+    }
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    if (list_entry (e, struct block_request, elem)->sector > r->sector)
+      break;
+  list_insert (e, &r->elem);
+  cond_signal (&block->queue_cond, &block->queue_lock);
+  lock_release (&block->queue_lock);
+}
+
+/* Wakes the thread waiting on semaphore SEMA. */
+static void
+wake (void *sema)
+{
+  sema_up (sema);
+}
+
+/* Transfers consecutive sectors of BLOCK, starting at SECTOR, to
+   or from the IOV_CNT buffers in IOV through BLOCK's queue, and
+   waits for the transfer to finish. */
+static void
+block_io (struct block *block, block_sector_t sector,
+          const struct block_iovec *iov, size_t iov_cnt, bool write)
+{
+  struct block_request r;
+  struct semaphore done;
+
+  sema_init (&done, 0);
+  r.sector = sector;
+  r.write = write;
+  r.iov = iov;
+  r.iov_cnt = iov_cnt;
+  r.done = wake;
+  r.aux = &done;
+  block_submit (block, &r);
+  sema_down (&done);
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
@@ -120,9 +239,8 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  struct block_iovec iov = { buffer, 1 };
+  block_io (block, sector, &iov, 1, false);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +251,190 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  struct block_iovec iov = { (void *) buffer, 1 };
+  block_io (block, sector, &iov, 1, true);
+}
+
+/* Reads consecutive sectors of BLOCK, starting at SECTOR, into
+   the IOV_CNT buffers in IOV, filling each in turn.  Drivers that
+   support it do this with multi-sector commands, so reading a
+   page costs one device round trip rather than one per sector.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_readv (struct block *block, block_sector_t sector,
+             const struct block_iovec *iov, size_t iov_cnt)
+{
+  block_io (block, sector, iov, iov_cnt, false);
+}
+
+/* Writes consecutive sectors of BLOCK, starting at SECTOR, from
+   the IOV_CNT buffers in IOV, as block_readv().  Returns after
+   the block device has acknowledged receiving all the data. */
+void
+block_writev (struct block *block, block_sector_t sector,
+              const struct block_iovec *iov, size_t iov_cnt)
+{
+  block_io (block, sector, iov, iov_cnt, true);
+}
+
+/* Has BLOCK's driver transfer consecutive sectors, starting at
+   SECTOR, to or from the IOV_CNT buffers in IOV. */
+static void
+dispatch (struct block *block, block_sector_t sector,
+          const struct block_iovec *iov, size_t iov_cnt, bool write)
+{
+  size_t i;
+  block_sector_t j;
+
+  if (write && block->ops->writev != NULL)
+    block->ops->writev (block->aux, sector, iov, iov_cnt);
+  else if (!write && block->ops->readv != NULL)
+    block->ops->readv (block->aux, sector, iov, iov_cnt);
+  else
+    for (i = 0; i < iov_cnt; i++)
+      for (j = 0; j < iov[i].cnt; j++)
+        {
+          uint8_t *buf = (uint8_t *) iov[i].buf + j * BLOCK_SECTOR_SIZE;
+          if (write)
+            block->ops->write (block->aux, sector++, buf);
+          else
+            block->ops->read (block->aux, sector++, buf);
+        }
+}
+
+/* Returns the request BLOCK should serve next, which must have a
+   non-empty queue: the one most overdue, if any is, otherwise
+   the first at or after the head, wrapping around to the lowest
+   sector at the end of a sweep. */
+static struct block_request *
+next_request (struct block *block)
+{
+  struct block_request *overdue = NULL, *ahead = NULL;
+  int64_t now = timer_ticks ();
+  struct list_elem *e;
+
+  ASSERT (!list_empty (&block->queue));
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (r->deadline <= now
+          && (overdue == NULL || r->deadline < overdue->deadline))
+        overdue = r;
+      if (ahead == NULL && r->sector >= block->head)
+        ahead = r;
+    }
+  if (overdue != NULL)
+    return overdue;
+  if (ahead != NULL)
+    return ahead;
+  return list_entry (list_begin (&block->queue), struct block_request, elem);
+}
+
+/* Adds TICKS, the time BLOCK took to serve BATCH, to the device
+   each request in BATCH was submitted to, if that was a partition
+   of BLOCK rather than BLOCK itself.  A device with several
+   requests in the batch is charged once. */
+static void
+charge_origins (struct block *block, struct list *batch, int64_t ticks)
+{
+  struct list_elem *e, *f;
+
+  for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+    {
+      struct block *origin = list_entry (e, struct block_request,
+                                         elem)->origin;
+      if (origin == block)
+        continue;
+      for (f = list_begin (batch); f != e; f = list_next (f))
+        if (list_entry (f, struct block_request, elem)->origin == origin)
+          break;
+      if (f == e)
+        origin->io_ticks += ticks;
+    }
+}
+
+/* Serves the requests queued for block device BLOCK_. */
+static void
+queue_thread (void *block_)
+{
+  struct block *block = block_;
+
+  for (;;)
+    {
+      struct block_iovec iov[MERGE_IOV_MAX];
+      const struct block_iovec *iovp;
+      size_t iov_cnt;
+      struct block_request *first, *r;
+      struct list batch;
+      block_sector_t end;
+      int64_t start, elapsed;
+
+      /* Take the next request off the queue, with those after it
+         that continue it. */
+      lock_acquire (&block->queue_lock);
+      while (list_empty (&block->queue))
+        cond_wait (&block->queue_cond, &block->queue_lock);
+      first = next_request (block);
+      list_init (&batch);
+      list_remove (&first->elem);
+      list_push_back (&batch, &first->elem);
+      end = first->sector + first->cnt;
+      if (first->iov_cnt <= MERGE_IOV_MAX)
+        {
+          memcpy (iov, first->iov, first->iov_cnt * sizeof *iov);
+          iov_cnt = first->iov_cnt;
+          iovp = iov;
+          for (;;)
+            {
+              struct list_elem *e = list_begin (&block->queue);
+
+              while (e != list_end (&block->queue)
+                     && list_entry (e, struct block_request,
+                                    elem)->sector < end)
+                e = list_next (e);
+              if (e == list_end (&block->queue))
+                break;
+              r = list_entry (e, struct block_request, elem);
+              if (r->sector != end || r->write != first->write
+                  || iov_cnt + r->iov_cnt > MERGE_IOV_MAX)
+                break;
+              memcpy (iov + iov_cnt, r->iov, r->iov_cnt * sizeof *iov);
+              iov_cnt += r->iov_cnt;
+              end += r->cnt;
+              list_remove (&r->elem);
+              list_push_back (&batch, &r->elem);
+            }
+        }
+      else
+        {
+          iovp = first->iov;
+          iov_cnt = first->iov_cnt;
+        }
+      block->head = end;
+      lock_release (&block->queue_lock);
+
+      /* Only this thread drives the device, so the time spent
+         here is device time, whoever is waiting on it and however
+         many requests it serves.  Partitions, such as swap, are
+         charged for the batches that carried their requests.
+         Most transfers take less than a tick, but a tick falls
+         inside one as often as its length says, so the sum comes
+         out right over many of them. */
+      start = timer_ticks ();
+      dispatch (block, first->sector, iovp, iov_cnt, first->write);
+      elapsed = timer_elapsed (start);
+      block->io_ticks += elapsed;
+      charge_origins (block, &batch, elapsed);
+
+      /* DONE may free the request. */
+      while (!list_empty (&batch))
+        {
+          r = list_entry (list_pop_front (&batch), struct block_request, elem);
+          r->done (r->aux);
+        }
+    }
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -171,9 +469,18 @@ block_print_stats (void)
       struct block *block = block_by_role[i];
       if (block != NULL)
         {
-          printf ("%s (%s): %llu reads, %llu writes\n",
+          printf ("%s (%s): %llu reads, %llu writes",
                   block->name, block_type_name (block->type),
                   block->read_cnt, block->write_cnt);
+          if (i == BLOCK_SWAP && block->io_ticks > 0)
+            {
+              /* Hundredths of a MB/s, from sectors moved per tick. */
+              unsigned long long rate
+                = ((block->read_cnt + block->write_cnt) * BLOCK_SECTOR_SIZE
+                   * TIMER_FREQ * 100 / (1024 * 1024)) / block->io_ticks;
+              printf (", %llu.%02llu MB/s", rate / 100, rate % 100);
+            }
+          printf ("\n");
         }
     }
 }
@@ -200,6 +507,12 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->io_ticks = 0;
+  lock_init (&block->queue_lock);
+  cond_init (&block->queue_cond);
+  list_init (&block->queue);
+  block->head = 0;
+  block->has_thread = false;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
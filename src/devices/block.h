@@ -1,8 +1,10 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -49,10 +51,45 @@ struct block *block_get_by_name (const char *name);
 struct block *block_first (void);
 struct block *block_next (struct block *);
 
+/* One buffer of a vectored request: CNT sectors at BUF. */
+struct block_iovec
+  {
+    void *buf;
+    block_sector_t cnt;
+  };
+
+/* An asynchronous request to transfer consecutive sectors,
+   starting at SECTOR, to or from the IOV_CNT buffers in IOV.
+   Once the transfer is done, DONE is called with AUX from the
+   device's queue thread.  The request and its buffers must stay
+   valid until then. */
+typedef void block_done_func (void *aux);
+
+struct block_request
+  {
+    block_sector_t sector;              /* First sector. */
+    bool write;                         /* Write, or read? */
+    const struct block_iovec *iov;      /* Buffers. */
+    size_t iov_cnt;                     /* Number of buffers. */
+    block_done_func *done;              /* Called when done. */
+    void *aux;                          /* Passed to DONE. */
+
+    /* Owned by the block layer. */
+    struct list_elem elem;              /* Element in device queue. */
+    struct block *origin;               /* Device submitted to. */
+    block_sector_t cnt;                 /* Number of sectors. */
+    int64_t deadline;                   /* Serve first after this tick. */
+  };
+
 /* Block device operations. */
 block_sector_t block_size (struct block *);
+void block_submit (struct block *, struct block_request *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_readv (struct block *, block_sector_t,
+                  const struct block_iovec *, size_t iov_cnt);
+void block_writev (struct block *, block_sector_t,
+                   const struct block_iovec *, size_t iov_cnt);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
@@ -61,10 +98,24 @@ void block_print_stats (void);
 
 /* Lower-level interface to block device drivers. */
 
+/* READV and WRITEV transfer consecutive sectors starting at the
+   given one to or from a vector of buffers, in as few device
+   commands as possible.  They may be null, in which case the block
+   layer falls back to one READ or WRITE per sector.
+
+   A device that is only a window onto another, such as a
+   partition, instead sets MAP, which returns the underlying
+   device and translates *SECTOR into its numbering; its requests
+   then join the underlying device's queue. */
 struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+    void (*readv) (void *aux, block_sector_t,
+                   const struct block_iovec *, size_t iov_cnt);
+    void (*writev) (void *aux, block_sector_t,
+                    const struct block_iovec *, size_t iov_cnt);
+    struct block *(*map) (void *aux, block_sector_t *sector);
   };
 
 struct block *block_register (const char *name, enum block_type,
@@ -8,10 +8,20 @@
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   If the controller found on the PCI bus can act as a bus master
+   (as the PIIX IDE controller emulated by QEMU and Bochs does),
+   sectors are transferred by DMA: the driver hands the
+   controller a table of physical buffers and the disk interrupts
+   once when the whole command is done, instead of the CPU
+   copying each sector through the data register.  Otherwise,
+   and for buffers DMA cannot reach, PIO is used. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -34,6 +44,20 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
+
+/* Bus master IDE port addresses. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0)  /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)   /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)     /* PRD table. */
+
+/* Bus master Command Register bits. */
+#define BM_START 0x01           /* Start transfer. */
+#define BM_READ 0x08            /* Transfer from disk to memory. */
+
+/* Bus master Status Register bits. */
+#define BM_ERR 0x02             /* Error, write 1 to clear. */
+#define BM_INTR 0x04            /* Interrupt, write 1 to clear. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +73,28 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Largest number of sectors one READ or WRITE SECTOR command can
+   transfer; a sector count of 0 means this many. */
+#define MAX_CMD_SECTORS 256
+
+/* Physical Region Descriptor: one buffer of a DMA transfer.  A
+   buffer must be word aligned and must not cross a 64 kB
+   boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Bytes, 0 meaning 64 kB. */
+    uint16_t flags;             /* PRD_EOT on the last entry. */
+  };
+#define PRD_EOT 0x8000
+
+/* A PRD table fills one page, which keeps it from crossing a
+   64 kB boundary.  It has room for every sector of a command to
+   be split in two. */
+#define PRD_CNT (PGSIZE / sizeof (struct prd))
 
 /* An ATA device. */
 struct ata_disk
@@ -72,6 +118,9 @@ struct channel
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    uint16_t bm_base;           /* Bus master I/O port, or 0 if no DMA. */
+    struct prd *prdt;           /* PRD table, if DMA. */
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
@@ -81,11 +130,13 @@ static struct channel channels[CHANNEL_CNT];
 
 static struct block_operations ide_operations;
 
+static uint16_t find_bus_master (void);
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sector (struct ata_disk *, block_sector_t,
+                           block_sector_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -101,6 +152,7 @@ static void interrupt_handler (struct intr_frame *);
 void
 ide_init (void) 
 {
+  uint16_t bm_base = find_bus_master ();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -126,6 +178,20 @@ ide_init (void)
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+
+      /* Set up DMA, if the controller can do it. */
+      c->bm_base = 0;
+      c->prdt = NULL;
+      if (bm_base != 0)
+        {
+          c->prdt = palloc_get_page (0);
+          if (c->prdt != NULL)
+            {
+              c->bm_base = bm_base + chan_no * 8;
+              printf ("%s: bus master DMA at port 0x%"PRIx16"\n",
+                      c->name, c->bm_base);
+            }
+        }
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -155,6 +221,69 @@ ide_init (void)
     }
 }
 
+/* PCI configuration space access ports. */
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* Returns the 32-bit register at byte offset REG of the PCI
+   configuration space of device DEV, function FUNC on bus 0. */
+static uint32_t
+pci_read_config (int dev, int func, int reg)
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes VALUE to the 32-bit register at byte offset REG of the
+   PCI configuration space of device DEV, function FUNC on bus
+   0. */
+static void
+pci_write_config (int dev, int func, int reg, uint32_t value)
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Looks on PCI bus 0 for an IDE controller capable of bus
+   mastering, enables it as a bus master and returns the base
+   I/O port of its bus master registers.  Returns 0 if there is
+   none. */
+static uint16_t
+find_bus_master (void)
+{
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++)
+      {
+        uint32_t id = pci_read_config (dev, func, 0x00);
+        uint32_t class = pci_read_config (dev, func, 0x08);
+        uint32_t bar4;
+
+        if ((id & 0xffff) == 0xffff)
+          {
+            /* No function 0 means no device. */
+            if (func == 0)
+              break;
+            continue;
+          }
+
+        /* Class 1 (mass storage), subclass 1 (IDE), with bit 7
+           of the programming interface for bus mastering. */
+        if ((class >> 16) != 0x0101 || !(class & 0x8000))
+          continue;
+        bar4 = pci_read_config (dev, func, 0x20);
+        if (!(bar4 & 1) || (bar4 & ~3u) == 0)
+          continue;
+
+        /* Enable I/O space and bus mastering. */
+        pci_write_config (dev, func, 0x04,
+                          pci_read_config (dev, func, 0x04) | 0x05);
+        return bar4 & 0xfffc;
+      }
+  return 0;
+}
+
 /* Disk detection and identification. */
 
 static char *descramble_ata_string (char *, int size);
@@ -337,25 +466,214 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Cursor over the sectors of a vectored request. */
+struct iov_cursor
+  {
+    const struct block_iovec *iov;      /* Current buffer. */
+    block_sector_t ofs;                 /* Sectors used of it. */
+  };
+
+/* Returns the next sector-sized piece of the buffers under CUR
+   and advances CUR past it. */
+static uint8_t *
+iov_next (struct iov_cursor *cur)
+{
+  while (cur->ofs == cur->iov->cnt)
+    {
+      cur->iov++;
+      cur->ofs = 0;
+    }
+  return (uint8_t *) cur->iov->buf + cur->ofs++ * BLOCK_SECTOR_SIZE;
+}
+
+/* Returns the total number of sectors in the IOV_CNT buffers of
+   IOV. */
+static block_sector_t
+iov_sectors (const struct block_iovec *iov, size_t iov_cnt)
+{
+  block_sector_t cnt = 0;
+  size_t i;
+
+  for (i = 0; i < iov_cnt; i++)
+    cnt += iov[i].cnt;
+  return cnt;
+}
+
+/* Fills in channel C's PRD table with the next CNT sectors of
+   the buffers under CUR, advancing CUR past them.  Pieces that
+   are contiguous in physical memory share an entry.  Returns
+   false if a buffer cannot be reached by DMA. */
+static bool
+build_prdt (struct channel *c, struct iov_cursor *cur, block_sector_t cnt)
+{
+  struct prd *prd = NULL;
+  size_t prd_cnt = 0;
+  block_sector_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      uint8_t *buf = iov_next (cur);
+      uint32_t addr, left;
+
+      /* The controller transfers 16-bit words, so each buffer
+         must start at an even address. */
+      if (!is_kernel_vaddr (buf) || ((uintptr_t) buf & 1) != 0)
+        return false;
+      addr = vtop (buf);
+      left = BLOCK_SECTOR_SIZE;
+      while (left > 0)
+        {
+          /* Bytes up to the next 64 kB boundary. */
+          uint32_t chunk = 0x10000 - (addr & 0xffff);
+          if (chunk > left)
+            chunk = left;
+
+          if (prd != NULL && prd->addr + prd->size == addr
+              && (addr & 0xffff) != 0)
+            prd->size += chunk;
+          else
+            {
+              ASSERT (prd_cnt < PRD_CNT);
+              prd = &c->prdt[prd_cnt++];
+              prd->addr = addr;
+              prd->size = chunk;
+              prd->flags = 0;
+            }
+          addr += chunk;
+          left -= chunk;
+        }
+    }
+  prd->flags = PRD_EOT;
+  return true;
+}
+
+/* Transfers CNT sectors of disk D, starting at SEC_NO, by DMA
+   between the disk and the buffers described by its channel's
+   PRD table, reading from the disk if READ or writing to it
+   otherwise.  Returns after the disk has interrupted to say the
+   whole transfer is done.  Panics on error. */
+static void
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, block_sector_t cnt,
+              bool read)
+{
+  struct channel *c = d->channel;
+  uint8_t bm_status, status;
+
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_command (c), read ? BM_READ : 0);
+  outb (reg_bm_status (c), BM_ERR | BM_INTR);
+
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, read ? CMD_READ_DMA : CMD_WRITE_DMA);
+  outb (reg_bm_command (c), (read ? BM_READ : 0) | BM_START);
+  sema_down (&c->completion_wait);
+
+  outb (reg_bm_command (c), 0);
+  bm_status = inb (reg_bm_status (c));
+  outb (reg_bm_status (c), BM_ERR | BM_INTR);
+  status = inb (reg_alt_status (c));
+  if ((bm_status & BM_ERR) || (status & STA_ERR))
+    PANIC ("%s: disk %s failed, sectors %"PRDSNu"+%"PRDSNu,
+           d->name, read ? "read" : "write", sec_no, cnt);
+}
+
+/* Reads consecutive sectors of disk D, starting at SEC_NO, into
+   the IOV_CNT buffers in IOV.  Issues one command per
+   MAX_CMD_SECTORS sectors: READ DMA if the channel can, else
+   READ SECTOR, for which the disk interrupts as each sector
+   becomes ready.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_readv (void *d_, block_sector_t sec_no,
+           const struct block_iovec *iov, size_t iov_cnt)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  struct iov_cursor cur = { iov, 0 };
+  block_sector_t left = iov_sectors (iov, iov_cnt);
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  while (left > 0)
+    {
+      block_sector_t cnt = left < MAX_CMD_SECTORS ? left : MAX_CMD_SECTORS;
+      struct iov_cursor start = cur;
+      block_sector_t i;
+
+      if (c->bm_base != 0 && build_prdt (c, &cur, cnt))
+        dma_transfer (d, sec_no, cnt, true);
+      else
+        {
+          cur = start;
+          select_sector (d, sec_no, cnt);
+          issue_pio_command (c, CMD_READ_SECTOR_RETRY);
+          for (i = 0; i < cnt; i++)
+            {
+              sema_down (&c->completion_wait);
+              if (!wait_while_busy (d))
+                PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                       d->name, sec_no + i);
+              input_sector (c, iov_next (&cur));
+            }
+        }
+      sec_no += cnt;
+      left -= cnt;
+    }
+  lock_release (&c->lock);
+}
+
+/* Writes consecutive sectors of disk D, starting at SEC_NO, from
+   the IOV_CNT buffers in IOV, as ide_readv().  Returns after the
+   disk has acknowledged receiving all the data. */
+static void
+ide_writev (void *d_, block_sector_t sec_no,
+            const struct block_iovec *iov, size_t iov_cnt)
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+  struct iov_cursor cur = { iov, 0 };
+  block_sector_t left = iov_sectors (iov, iov_cnt);
+
+  lock_acquire (&c->lock);
+  while (left > 0)
+    {
+      block_sector_t cnt = left < MAX_CMD_SECTORS ? left : MAX_CMD_SECTORS;
+      struct iov_cursor start = cur;
+      block_sector_t i;
+
+      if (c->bm_base != 0 && build_prdt (c, &cur, cnt))
+        dma_transfer (d, sec_no, cnt, false);
+      else
+        {
+          cur = start;
+          select_sector (d, sec_no, cnt);
+          issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
+          for (i = 0; i < cnt; i++)
+            {
+              if (!wait_while_busy (d))
+                PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                       d->name, sec_no + i);
+              output_sector (c, iov_next (&cur));
+              sema_down (&c->completion_wait);
+            }
+        }
+      sec_no += cnt;
+      left -= cnt;
+    }
   lock_release (&c->lock);
 }
 
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read (void *d_, block_sector_t sec_no, void *buffer)
+{
+  struct block_iovec iov = { buffer, 1 };
+  ide_readv (d_, sec_no, &iov, 1);
+}
+
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
    BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
    acknowledged receiving the data.
@@ -364,36 +682,32 @@ ide_read (void *d_, block_sector_t sec_no, void *buffer)
 static void
 ide_write (void *d_, block_sector_t sec_no, const void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+  struct block_iovec iov = { (void *) buffer, 1 };
+  ide_writev (d_, sec_no, &iov, 1);
 }
 
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_readv,
+    ide_writev,
+    NULL
   };
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the count CNT of sectors to transfer to the
+   disk's sector selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, block_sector_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_CMD_SECTORS);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt % MAX_CMD_SECTORS);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
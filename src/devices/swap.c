@@ -1,10 +1,12 @@
 #include "devices/swap.h"
 #include "devices/block.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 #include <bitmap.h>
 #include <debug.h>
 #include <stdio.h>
+#include <string.h>
 
 /* Pointer to the swap device */
 static struct block *swap_device;
@@ -12,12 +14,39 @@ static struct block *swap_device;
 /* Pointer to a bitmap to track used swap pages */
 static struct bitmap *swap_bitmap;
 
-/* Lock that protects swap_bitmap from unsynchronised access */
+/* Lock that protects swap_bitmap and swap_cursor from
+   unsynchronised access */
 static struct lock swap_lock;
 
+/* Slot after the last one handed out.  Allocation is next-fit from
+   here rather than first-fit from 0, so that pages swapped out
+   one after another land next to each other on disk. */
+static size_t swap_cursor;
+
 /* Number of sectors needed to store a page */
 #define PAGE_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
 
+/* Swap cache: kernel pages holding copies of swap-slots read ahead
+   of the faults that will want them.  A slot stays allocated while
+   cached, so an entry is valid until the slot is swapped in or
+   dropped.  Entries are reused round-robin; a cached copy is
+   always clean, so replacing one costs nothing but the read.
+   Guarded by swap_lock. */
+#define SWAP_CACHE_SIZE 32
+
+struct swap_cache_entry
+  {
+    size_t slot;        /* BITMAP_ERROR if the entry is unused */
+    void *page;         /* Kernel page, allocated on first use */
+    bool busy;          /* Being read into, not to be replaced */
+  };
+
+static struct swap_cache_entry swap_cache[SWAP_CACHE_SIZE];
+static size_t cache_hand;
+
+static struct swap_cache_entry *cache_find (size_t slot);
+static struct swap_cache_entry *cache_claim (size_t slot);
+
 /* Sets up the swap space */
 void
 swap_init (void) 
@@ -37,50 +66,210 @@ swap_init (void)
     PANIC ("couldn't create swap bitmap");
   }
   lock_init (&swap_lock);
+  swap_cursor = 0;
+
+  for (size_t i = 0; i < SWAP_CACHE_SIZE; i++)
+    swap_cache[i].slot = BITMAP_ERROR;
+  cache_hand = 0;
+}
+
+/* Allocates CNT consecutive swap-slots, returning the first, or
+   BITMAP_ERROR if there is no such run free */
+static size_t
+alloc_slots (size_t cnt)
+{
+  lock_acquire (&swap_lock);
+  size_t slot = bitmap_scan_and_flip (swap_bitmap, swap_cursor, cnt, false);
+  if (slot == BITMAP_ERROR && swap_cursor != 0)
+    slot = bitmap_scan_and_flip (swap_bitmap, 0, cnt, false);
+  if (slot != BITMAP_ERROR)
+    swap_cursor = slot + cnt;
+  lock_release (&swap_lock);
+  return slot;
 }
 
 /* Swaps page at VADDR out of memory, returns the swap-slot used */
 size_t
 swap_out (const void *vaddr) 
 {
-  // find available swap-slot for the page to be swapped out
-  lock_acquire (&swap_lock);
-  size_t slot = bitmap_scan_and_flip (swap_bitmap, 0, 1, false);
-  lock_release (&swap_lock);
-  if (slot == BITMAP_ERROR) 
-  {
-    // printf("BITMAP_ERROR %u\n", BITMAP_ERROR);
-    return BITMAP_ERROR; 
-  }
+  size_t slot;
+  swap_out_cluster (&vaddr, 1, &slot);
+  return slot;
+}
 
-  // calculate block sector from swap-slot number
-  size_t sector = slot * PAGE_SECTORS;
-  
-  // loop over each sector of the page, copying it from memory into swap
-  for (size_t i = 0; i < PAGE_SECTORS; i++)
-    block_write (swap_device, sector + i, vaddr + i * BLOCK_SECTOR_SIZE);
+/* Swaps the CNT pages at PAGES out of memory, storing the
+   swap-slot used for each in SLOTS.  The pages go to consecutive
+   slots and are written with a single device request when such a
+   run is free; otherwise each gets its own slot.  A page that
+   cannot be given a slot has BITMAP_ERROR stored for it. */
+void
+swap_out_cluster (const void *pages[], size_t cnt, size_t slots[])
+{
+  ASSERT (cnt <= SWAP_CLUSTER);
+  if (cnt == 0)
+    return;
 
-  return slot;
+  size_t first = alloc_slots (cnt);
+  if (first == BITMAP_ERROR)
+    {
+      // no run long enough: write the pages wherever they fit
+      for (size_t i = 0; i < cnt; i++)
+        slots[i] = cnt > 1 ? swap_out (pages[i]) : BITMAP_ERROR;
+      return;
+    }
+
+  // one request moves every page, PAGE_SECTORS sectors each
+  struct block_iovec iov[SWAP_CLUSTER];
+  for (size_t i = 0; i < cnt; i++)
+    {
+      iov[i].buf = (void *) pages[i];
+      iov[i].cnt = PAGE_SECTORS;
+      slots[i] = first + i;
+    }
+  block_writev (swap_device, first * PAGE_SECTORS, iov, cnt);
 }
 
 /* Swaps page on disk in swap-slot SLOT into memory at VADDR */
 void
 swap_in (void *vaddr, size_t slot) 
 {
-  // calculate block sector from swap-slot number
-  size_t sector = slot * PAGE_SECTORS;
+  swap_in_ahead (vaddr, slot, 0);
+}
 
-  // loop over each sector of the page, copying it from swap into memory
-  for (size_t i = 0; i < PAGE_SECTORS; i++)
-    block_read (swap_device, sector + i, vaddr + i * BLOCK_SECTOR_SIZE);
-  
+/* Swaps page in swap-slot SLOT into memory at VADDR, like
+   swap_in(), and reads up to AHEAD of the slots following it into
+   the swap cache so that faults on them need no disk access.  The
+   caller vouches that those slots are in use.  Reading stops at
+   the first slot already cached.  If SLOT itself was read ahead
+   earlier it is copied from the cache and readahead continues
+   past the cached run.  Returns true if SLOT came from the
+   cache. */
+bool
+swap_in_ahead (void *vaddr, size_t slot, size_t ahead)
+{
+  struct block_iovec iov[1 + SWAP_READAHEAD_MAX];
+  struct swap_cache_entry *claimed[SWAP_READAHEAD_MAX];
+  size_t iov_cnt = 0, claimed_cnt = 0;
+  size_t next = slot + 1;
+  size_t last = slot + (ahead < SWAP_READAHEAD_MAX
+                        ? ahead : SWAP_READAHEAD_MAX);
+
+  lock_acquire (&swap_lock);
+  struct swap_cache_entry *e = cache_find (slot);
+  bool hit = e != NULL;
+  if (hit)
+    {
+      memcpy (vaddr, e->page, PGSIZE);
+      e->slot = BITMAP_ERROR;
+      bitmap_reset (swap_bitmap, slot);
+
+      // skip what an earlier readahead already brought in
+      while (next <= last && cache_find (next) != NULL)
+        next++;
+    }
+  else
+    {
+      iov[iov_cnt].buf = vaddr;
+      iov[iov_cnt++].cnt = PAGE_SECTORS;
+    }
+
+  size_t first = next;
+  for (; next <= last && cache_find (next) == NULL; next++)
+    {
+      struct swap_cache_entry *c = cache_claim (next);
+      if (c == NULL)
+        break;
+      claimed[claimed_cnt++] = c;
+      iov[iov_cnt].buf = c->page;
+      iov[iov_cnt++].cnt = PAGE_SECTORS;
+    }
+  lock_release (&swap_lock);
+
+  // SLOT, unless cached, and the readahead go in one request
+  if (iov_cnt > 0)
+    block_readv (swap_device, (hit ? first : slot) * PAGE_SECTORS, iov,
+                 iov_cnt);
+
+  lock_acquire (&swap_lock);
+  for (size_t i = 0; i < claimed_cnt; i++)
+    claimed[i]->busy = false;
   // clear the swap-slot previously used by this page
-  bitmap_reset (swap_bitmap, slot);
+  if (!hit)
+    bitmap_reset (swap_bitmap, slot);
+  lock_release (&swap_lock);
+  return hit;
+}
+
+/* Copies the page in swap-slot SLOT to a new slot and returns
+   it, or BITMAP_ERROR if there is no free slot or no kernel page
+   to copy through.  SLOT stays in use. */
+size_t
+swap_copy (size_t slot)
+{
+  void *page = palloc_get_page (0);
+  if (page == NULL)
+    return BITMAP_ERROR;
+
+  size_t copy = alloc_slots (1);
+  if (copy != BITMAP_ERROR)
+    {
+      struct block_iovec iov = { page, PAGE_SECTORS };
+      block_readv (swap_device, slot * PAGE_SECTORS, &iov, 1);
+      block_writev (swap_device, copy * PAGE_SECTORS, &iov, 1);
+    }
+  palloc_free_page (page);
+  return copy;
 }
 
 void 
 swap_drop (size_t slot)
 {
+  lock_acquire (&swap_lock);
+  struct swap_cache_entry *e = cache_find (slot);
+  if (e != NULL)
+    e->slot = BITMAP_ERROR;
   bitmap_reset (swap_bitmap, slot);
+  lock_release (&swap_lock);
 }
 
+/* Returns the number of page-sized slots on the swap device */
+size_t
+swap_slot_count (void)
+{
+  return bitmap_size (swap_bitmap);
+}
+
+/* Returns the cache entry holding SLOT, or NULL */
+static struct swap_cache_entry *
+cache_find (size_t slot)
+{
+  for (size_t i = 0; i < SWAP_CACHE_SIZE; i++)
+    if (swap_cache[i].slot == slot)
+      return &swap_cache[i];
+  return NULL;
+}
+
+/* Takes a cache entry for SLOT, marked busy, with a page to read
+   it into.  Returns NULL if every entry is busy or no kernel page
+   is left for it. */
+static struct swap_cache_entry *
+cache_claim (size_t slot)
+{
+  for (size_t i = 0; i < SWAP_CACHE_SIZE; i++)
+    {
+      struct swap_cache_entry *c = &swap_cache[cache_hand];
+      cache_hand = (cache_hand + 1) % SWAP_CACHE_SIZE;
+      if (c->busy)
+        continue;
+      if (c->page == NULL)
+        {
+          c->page = palloc_get_page (0);
+          if (c->page == NULL)
+            return NULL;
+        }
+      c->slot = slot;
+      c->busy = true;
+      return c;
+    }
+  return NULL;
+}
@@ -1,12 +1,23 @@
 #ifndef DEVICES_SWAP_H
 #define DEVICES_SWAP_H 1
 
+#include <stdbool.h>
 #include <stddef.h>
 
+/* Most pages swap_out_cluster() writes in one request */
+#define SWAP_CLUSTER 8
+
+/* Most slots swap_in_ahead() reads past the one faulted on */
+#define SWAP_READAHEAD_MAX 8
+
 void swap_init (void);
 size_t swap_out (const void *vaddr);
+void swap_out_cluster (const void *pages[], size_t cnt, size_t slots[]);
 void swap_in (void *vaddr, size_t slot);
+bool swap_in_ahead (void *vaddr, size_t slot, size_t ahead);
+size_t swap_copy (size_t slot);
 void swap_drop (size_t slot);
+size_t swap_slot_count (void);
 
 
 #endif /* devices/swap.h */
\ No newline at end of file
@@ -20,8 +20,24 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
-/* List of alarms required for waking sleeping threads. */
-struct list alarms;
+/* Hierarchical timer wheel holding the alarms of sleeping
+   threads.  Level 0 has one slot per tick for the next
+   WHEEL_SIZE ticks; each slot of level N covers WHEEL_SIZE^N
+   ticks and is cascaded down one level when level N-1 wraps
+   around.  Alarms further away than the whole wheel spans sit in
+   the last level and are re-filed each time they cascade.
+   Inserting an alarm is O(1), and each tick only touches the
+   alarms that are due (plus the occasional cascade). */
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+#define WHEEL_SPAN (1LL << (WHEEL_BITS * WHEEL_LEVELS))
+
+static struct list wheel[WHEEL_LEVELS][WHEEL_SIZE];
+
+/* Next tick whose level-0 slot has not yet been expired. */
+static int64_t wheel_ticks;
 
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
@@ -32,8 +48,9 @@ static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
-static bool 
-  comparator (const struct list_elem *a, const struct list_elem *b, void *aux);
+static void wheel_add (struct alarm *);
+static int wheel_cascade (int level);
+static void wheel_expire (void);
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
@@ -42,8 +59,13 @@ timer_init (void)
 {
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
-  /* configure alarms list */
-  list_init(&alarms);     
+
+  /* configure the alarm wheel */
+  int level, slot;
+  for (level = 0; level < WHEEL_LEVELS; level++)
+    for (slot = 0; slot < WHEEL_SIZE; slot++)
+      list_init (&wheel[level][slot]);
+  wheel_ticks = 0;
 }
 
 /* Calibrates loops_per_tick, used to implement brief delays. */
@@ -114,10 +136,17 @@ timer_sleep (int64_t ticks)
   alm.sp = &timer_up;
   sema_init(&timer_up, 0);
   
-  /* locking down the alarms list by disabling interrupts to prevent
-     race conditions when inserting an alarm in different threads */
+  /* locking down the alarm wheel by disabling interrupts to prevent
+     race conditions with other sleepers and the tick handler; the
+     insertion is constant time so this window stays short */
   old_level = intr_disable();
-  list_insert_ordered(&alarms, &(alm.elem), comparator, NULL);
+  if (sleep_time <= timer_ticks ())
+  {
+    /* the wake up time already passed while we were getting here */
+    intr_set_level(old_level);
+    return;
+  }
+  wheel_add (&alm);
   intr_set_level(old_level);
   
   /* put thread to sleep */
@@ -199,20 +228,7 @@ static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
   ticks++;
-  // check list of alarms
-  struct list_elem *e;
-  for (e = list_begin (&alarms); e != list_end (&alarms);) {
-      struct alarm *alm = list_entry (e, struct alarm, elem);
-      int64_t time = alm->time;
-      e = list_next (e);
-      // Note: ticks <= wake up time (necessary)
-      if (ticks == time) {
-        sema_up(alm->sp);
-        list_pop_front(&alarms);
-      } else {
-        break;
-      }  
-  }
+  wheel_expire ();
   thread_tick (); 
 }
 
@@ -287,10 +303,74 @@ real_time_delay (int64_t num, int32_t denom)
   busy_wait (loops_per_tick * num / 1000 * TIMER_FREQ / (denom / 1000)); 
 }
 
-/* comparator for ordered list alarms. */
-static bool 
-comparator (const struct list_elem *a, 
-  const struct list_elem *b, void *aux UNUSED){
-    return (list_entry (a, struct alarm, elem) -> time) 
-            < (list_entry (b, struct alarm, elem) -> time);
-}
\ No newline at end of file
+/* Files ALM in the wheel slot covering its wake up time.
+   Must be called with interrupts off. */
+static void
+wheel_add (struct alarm *alm)
+{
+  int64_t time = alm->time;
+  int64_t delta = time - wheel_ticks;
+  int level;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (delta < 0)
+    {
+      /* Already due: expire it with the next tick processed. */
+      time = wheel_ticks;
+      delta = 0;
+    }
+  else if (delta >= WHEEL_SPAN)
+    {
+      /* Beyond the wheel: park it as far out as we can, it will be
+         re-filed by wheel_cascade() once that slot comes round. */
+      time = wheel_ticks + WHEEL_SPAN - 1;
+      delta = WHEEL_SPAN - 1;
+    }
+
+  for (level = 0; level < WHEEL_LEVELS - 1; level++)
+    if (delta < 1LL << (WHEEL_BITS * (level + 1)))
+      break;
+
+  list_push_back (&wheel[level][(time >> (WHEEL_BITS * level)) & WHEEL_MASK],
+                  &alm->elem);
+}
+
+/* Moves every alarm in the current slot of LEVEL down to the
+   levels below it.  Returns the index of the slot cascaded, so
+   the caller knows whether LEVEL itself has wrapped around. */
+static int
+wheel_cascade (int level)
+{
+  int slot = (wheel_ticks >> (WHEEL_BITS * level)) & WHEEL_MASK;
+  struct list *bucket = &wheel[level][slot];
+
+  while (!list_empty (bucket))
+    wheel_add (list_entry (list_pop_front (bucket), struct alarm, elem));
+  return slot;
+}
+
+/* Wakes every sleeping thread whose alarm time is at or before
+   the current tick, catching up on any ticks not yet processed.
+   Runs in the timer interrupt. */
+static void
+wheel_expire (void)
+{
+  while (wheel_ticks <= ticks)
+    {
+      int slot = wheel_ticks & WHEEL_MASK;
+      struct list *bucket = &wheel[0][slot];
+      int level;
+
+      /* Level 0 wrapped: pull the next stretch of alarms down. */
+      if (slot == 0)
+        for (level = 1; level < WHEEL_LEVELS; level++)
+          if (wheel_cascade (level) != 0)
+            break;
+
+      while (!list_empty (bucket))
+        sema_up (list_entry (list_pop_front (bucket), struct alarm, elem)->sp);
+
+      wheel_ticks++;
+    }
+}
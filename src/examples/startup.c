@@ -0,0 +1,52 @@
+/* startup.c
+
+   Benchmark for program startup.  Usage:
+
+     startup <count> <program> [<args>...]
+
+   Runs the given command line COUNT times, one run after
+   another, waiting for each.  Most of a short program's time
+   goes on faulting in its code and data, so running e.g.
+   "startup 50 echo hello" and reading the timer ticks and page
+   faults the kernel prints at shutdown shows what loading costs,
+   per run once divided by COUNT. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+
+int
+main (int argc, char *argv[])
+{
+  char cmd_line[128];
+  int count, failed = 0;
+  int i;
+
+  if (argc < 3)
+    {
+      printf ("usage: startup <count> <program> [<args>...]\n");
+      return EXIT_FAILURE;
+    }
+  count = atoi (argv[1]);
+
+  /* Rebuild the command line to run. */
+  cmd_line[0] = '\0';
+  for (i = 2; i < argc; i++)
+    {
+      if (i > 2)
+        strlcat (cmd_line, " ", sizeof cmd_line);
+      strlcat (cmd_line, argv[i], sizeof cmd_line);
+    }
+
+  for (i = 0; i < count; i++)
+    {
+      pid_t pid = exec (cmd_line);
+      if (pid == PID_ERROR || wait (pid) != 0)
+        failed++;
+    }
+
+  printf ("startup: ran \"%s\" %d times, %d failed\n",
+          cmd_line, count, failed);
+  return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,363 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Buffer cache.
+
+   Every file system sector is read and written through a fixed
+   array of CACHE_SIZE sector buffers.  Writes only dirty the
+   buffer; a write-behind thread saves dirty buffers every
+   FLUSH_INTERVAL, and cache_flush() saves the rest when the file
+   system is shut down.  A read-ahead thread loads the sector a
+   sequential reader is expected to want next.
+
+   cache_lock guards which sector each entry holds, the clock
+   hand and the pin counts.  Each entry's own lock guards its
+   data and dirty bit and is held while the entry is loaded from
+   or written to disk, so that a thread finding a sector that is
+   still being read in simply waits for it.  No disk I/O is done
+   under cache_lock.  Only an entry with no pins may be given to
+   another sector. */
+
+/* Ticks between write-behind passes. */
+#define FLUSH_INTERVAL (TIMER_FREQ * 5)
+
+/* Most read-ahead requests waiting at once; more are dropped. */
+#define READ_AHEAD_MAX 16
+
+/* Sector value of an entry holding nothing. */
+#define NO_SECTOR ((block_sector_t) -1)
+
+/* DATA comes first and is word aligned, as bus-master DMA can
+   only reach buffers at even addresses; see build_prdt() in
+   devices/ide.c. */
+struct cache_entry
+  {
+    uint8_t data[BLOCK_SECTOR_SIZE]     /* Sector contents. */
+      __attribute__ ((aligned (4)));
+    block_sector_t sector;              /* Sector held, or NO_SECTOR. */
+    unsigned pin_cnt;                   /* Users; not evictable if > 0. */
+    bool accessed;                      /* Used since the hand passed. */
+    struct lock lock;                   /* Guards DIRTY and DATA. */
+    bool dirty;                         /* Modified since written out. */
+  };
+
+static struct cache_entry cache[CACHE_SIZE];
+static struct lock cache_lock;
+static size_t hand;
+
+/* Serialises cache_flush(), which uses static request arrays. */
+static struct lock flush_lock;
+
+/* Sectors waiting for the read-ahead thread, a ring buffer
+   guarded by cache_lock. */
+static block_sector_t ra_queue[READ_AHEAD_MAX];
+static size_t ra_head, ra_cnt;
+static struct semaphore ra_sema;
+
+/* Statistics. */
+static long long hit_cnt, miss_cnt, read_ahead_cnt;
+
+static thread_func flush_thread;
+static thread_func read_ahead_thread;
+static struct cache_entry *cache_lookup (block_sector_t);
+static struct cache_entry *choose_victim (void);
+static struct cache_entry *cache_get (block_sector_t, bool fill);
+static void cache_put (struct cache_entry *);
+
+/* Initializes the buffer cache and starts its threads. */
+void
+cache_init (void)
+{
+  size_t i;
+
+  lock_init (&cache_lock);
+  lock_init (&flush_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      cache[i].sector = NO_SECTOR;
+      cache[i].pin_cnt = 0;
+      cache[i].accessed = false;
+      cache[i].dirty = false;
+      lock_init (&cache[i].lock);
+    }
+  hand = 0;
+  ra_head = ra_cnt = 0;
+  sema_init (&ra_sema, 0);
+
+  thread_create ("cache-flush", PRI_DEFAULT, flush_thread, NULL);
+  thread_create ("cache-ra", PRI_DEFAULT, read_ahead_thread, NULL);
+}
+
+/* Returns the entry holding SECTOR, or a null pointer if none
+   does.  cache_lock must be held. */
+static struct cache_entry *
+cache_lookup (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Returns an unpinned entry chosen by second chance, or a null
+   pointer if every entry is pinned.  cache_lock must be held. */
+static struct cache_entry *
+choose_victim (void)
+{
+  size_t i;
+
+  for (i = 0; i < 2 * CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[hand];
+      hand = (hand + 1) % CACHE_SIZE;
+      if (e->pin_cnt > 0)
+        continue;
+      if (!e->accessed)
+        return e;
+      e->accessed = false;
+    }
+  return NULL;
+}
+
+/* Returns the entry holding SECTOR pinned, with its lock held,
+   loading the sector from disk if FILL.  Without FILL the caller
+   must overwrite the whole sector. */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool fill)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      e = cache_lookup (sector);
+      if (e != NULL)
+        {
+          e->pin_cnt++;
+          e->accessed = true;
+          hit_cnt++;
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          return e;
+        }
+
+      e = choose_victim ();
+      if (e == NULL)
+        {
+          /* Every entry is pinned.  Pins are short, so let their
+             users finish, then look again: another thread may
+             have loaded SECTOR in the meantime. */
+          lock_release (&cache_lock);
+          thread_yield ();
+          lock_acquire (&cache_lock);
+          continue;
+        }
+
+      /* Nobody holds an unpinned entry's lock. */
+      lock_acquire (&e->lock);
+      e->pin_cnt = 1;
+      if (!e->dirty)
+        break;
+
+      /* A dirty victim is written out before the entry changes
+         hands, so that a miss on its old sector cannot read
+         stale data from disk; the write-behind thread keeps this
+         rare.  The write is done without cache_lock.  The pin
+         keeps the entry from being chosen again, and a thread
+         that wants the old sector meanwhile finds it and waits
+         for the entry's lock.  If one did, it keeps the entry,
+         and if another thread loaded SECTOR meanwhile we use its
+         entry; either way we start over. */
+      lock_release (&cache_lock);
+      block_write (fs_device, e->sector, e->data);
+      e->dirty = false;
+      lock_acquire (&cache_lock);
+      if (e->pin_cnt == 1 && cache_lookup (sector) == NULL)
+        break;
+      e->pin_cnt--;
+      lock_release (&e->lock);
+    }
+  miss_cnt++;
+  e->sector = sector;
+  e->accessed = true;
+  lock_release (&cache_lock);
+
+  if (fill)
+    block_read (fs_device, sector, e->data);
+  return e;
+}
+
+/* Releases entry E obtained with cache_get(). */
+static void
+cache_put (struct cache_entry *e)
+{
+  lock_release (&e->lock);
+  lock_acquire (&cache_lock);
+  ASSERT (e->pin_cnt > 0);
+  e->pin_cnt--;
+  lock_release (&cache_lock);
+}
+
+/* Reads SIZE bytes starting at byte OFS of SECTOR into BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, off_t ofs, off_t size)
+{
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  struct cache_entry *e = cache_get (sector, true);
+  memcpy (buffer, e->data + ofs, size);
+  cache_put (e);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR starting at byte
+   OFS.  The sector reaches the disk later, see flush_thread(). */
+void
+cache_write_at (block_sector_t sector, const void *buffer, off_t ofs,
+                off_t size)
+{
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  struct cache_entry *e = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  e->dirty = true;
+  cache_put (e);
+}
+
+/* Asks for SECTOR to be loaded in the background, if it is not
+   cached already. */
+void
+cache_read_ahead (block_sector_t sector)
+{
+  bool queued = false;
+
+  lock_acquire (&cache_lock);
+  if (ra_cnt < READ_AHEAD_MAX)
+    {
+      ra_queue[(ra_head + ra_cnt++) % READ_AHEAD_MAX] = sector;
+      queued = true;
+    }
+  lock_release (&cache_lock);
+
+  if (queued)
+    sema_up (&ra_sema);
+}
+
+/* Wakes the thread waiting on semaphore SEMA, for each write
+   of cache_flush() that completes. */
+static void
+flush_done (void *sema)
+{
+  sema_up (sema);
+}
+
+/* Writes every dirty entry to disk.  All the writes are queued
+   before any is waited for, so that the block layer can sort
+   them and merge neighbours into single commands.  Each entry
+   stays locked until its write is done. */
+void
+cache_flush (void)
+{
+  static struct block_request reqs[CACHE_SIZE];
+  static struct block_iovec iovs[CACHE_SIZE];
+  static struct cache_entry *entries[CACHE_SIZE];
+  struct semaphore done;
+  size_t i, cnt = 0;
+
+  lock_acquire (&flush_lock);
+  sema_init (&done, 0);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      struct block_request *r;
+
+      lock_acquire (&cache_lock);
+      if (e->sector == NO_SECTOR)
+        {
+          lock_release (&cache_lock);
+          continue;
+        }
+      e->pin_cnt++;
+      lock_release (&cache_lock);
+
+      lock_acquire (&e->lock);
+      if (!e->dirty)
+        {
+          cache_put (e);
+          continue;
+        }
+      e->dirty = false;
+
+      iovs[cnt].buf = e->data;
+      iovs[cnt].cnt = 1;
+      r = &reqs[cnt];
+      r->sector = e->sector;
+      r->write = true;
+      r->iov = &iovs[cnt];
+      r->iov_cnt = 1;
+      r->done = flush_done;
+      r->aux = &done;
+      entries[cnt++] = e;
+      block_submit (fs_device, r);
+    }
+
+  for (i = 0; i < cnt; i++)
+    sema_down (&done);
+  for (i = 0; i < cnt; i++)
+    cache_put (entries[i]);
+  lock_release (&flush_lock);
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  printf ("Cache: %lld hits, %lld misses, %lld read ahead\n",
+          hit_cnt, miss_cnt, read_ahead_cnt);
+}
+
+/* Write-behind: saves dirty entries every FLUSH_INTERVAL, so that
+   few are lost in a crash and eviction rarely has to write. */
+static void
+flush_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (FLUSH_INTERVAL);
+      cache_flush ();
+    }
+}
+
+/* Loads the sectors queued by cache_read_ahead(). */
+static void
+read_ahead_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      block_sector_t sector;
+      bool cached = false;
+      size_t i;
+
+      sema_down (&ra_sema);
+      lock_acquire (&cache_lock);
+      sector = ra_queue[ra_head];
+      ra_head = (ra_head + 1) % READ_AHEAD_MAX;
+      ra_cnt--;
+      for (i = 0; i < CACHE_SIZE; i++)
+        if (cache[i].sector == sector)
+          cached = true;
+      if (!cached)
+        read_ahead_cnt++;
+      lock_release (&cache_lock);
+
+      if (!cached)
+        cache_put (cache_get (sector, true));
+    }
+}
@@ -0,0 +1,17 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include "devices/block.h"
+#include "filesys/off_t.h"
+
+/* Number of sectors held in the buffer cache. */
+#define CACHE_SIZE 64
+
+void cache_init (void);
+void cache_read_at (block_sector_t, void *, off_t ofs, off_t size);
+void cache_write_at (block_sector_t, const void *, off_t ofs, off_t size);
+void cache_read_ahead (block_sector_t);
+void cache_flush (void);
+void cache_print_stats (void);
+
+#endif /* filesys/cache.h */
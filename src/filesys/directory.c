@@ -1,16 +1,26 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
-/* A directory. */
+/* A directory.
+
+   A directory's file is a header sector followed by BUCKET_CNT
+   sector-sized buckets, BUCKET_CNT a power of two.  A name lives
+   in the bucket picked by the low bits of its hash, so a lookup
+   reads a single bucket however large the directory grows.  When
+   the bucket a new name falls into is full, the table doubles:
+   bucket B is split between B and B + BUCKET_CNT by the next bit
+   of each name's hash. */
 struct dir 
   {
     struct inode *inode;                /* Backing store. */
-    off_t pos;                          /* Current position. */
+    off_t pos;                          /* Index of next entry to read. */
   };
 
 /* A single directory entry. */
@@ -21,12 +31,160 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* Entries in one bucket. */
+#define ENTRIES_PER_BUCKET (BLOCK_SECTOR_SIZE / sizeof (struct dir_entry))
+
+/* Largest number of buckets, which keeps a directory well within
+   the largest file an inode can index. */
+#define MAX_BUCKETS 8192
+
+/* First sector of a directory's file. */
+struct dir_header
+  {
+    uint32_t bucket_cnt;                /* Number of buckets. */
+  };
+
+/* One sector of directory entries. */
+struct dir_bucket
+  {
+    struct dir_entry entries[ENTRIES_PER_BUCKET];
+  };
+
+/* Serialises changes to directory contents, so that the lookup
+   and the write of dir_add() and dir_remove() happen as one, as
+   does the doubling of a directory's table.  Lookups need not
+   take it: each entry is written in a single inode_write_at(),
+   which readers of the inode never see half done.  Doubling
+   copies entries to their new bucket before the header points
+   lookups there, and only then drops the old copies, so a lookup
+   that reads the header again after its bucket and finds it
+   unchanged has seen a consistent table; otherwise it retries,
+   see lookup(). */
+static struct lock dir_lock;
+
+/* Names recently found, direct mapped by name hash and directory
+   so that repeated lookups skip reading the directory. */
+#define NAME_CACHE_SIZE 64
+
+struct name_cache_entry
+  {
+    bool valid;                         /* Holds a name? */
+    block_sector_t dir_sector;          /* Directory's inode sector. */
+    struct dir_entry e;                 /* Copy of the entry. */
+    off_t ofs;                          /* Entry's offset in the file. */
+  };
+
+static struct name_cache_entry name_cache[NAME_CACHE_SIZE];
+
+/* Guards name_cache and name_cache_gen.  name_cache_gen counts
+   invalidations, so that a lookup that read the disk before an
+   entry was removed or moved does not put it back. */
+static struct lock name_cache_lock;
+static unsigned name_cache_gen;
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  lock_init (&dir_lock);
+  lock_init (&name_cache_lock);
+}
+
+/* Returns the offset of entry SLOT of bucket BUCKET. */
+static off_t
+entry_ofs (uint32_t bucket, size_t slot)
+{
+  return (bucket + 1) * BLOCK_SECTOR_SIZE + slot * sizeof (struct dir_entry);
+}
+
+/* Reads DIR's header into *H.  Returns true if successful. */
+static bool
+read_header (const struct dir *dir, struct dir_header *h)
+{
+  return (inode_read_at (dir->inode, h, sizeof *h, 0) == sizeof *h
+          && h->bucket_cnt > 0);
+}
+
+/* Reads bucket BUCKET of DIR into *B.  Returns true if
+   successful. */
+static bool
+read_bucket (const struct dir *dir, uint32_t bucket, struct dir_bucket *b)
+{
+  return (inode_read_at (dir->inode, b, sizeof *b, entry_ofs (bucket, 0))
+          == sizeof *b);
+}
+
+/* Writes *B to bucket BUCKET of DIR.  Returns true if
+   successful. */
+static bool
+write_bucket (struct dir *dir, uint32_t bucket, const struct dir_bucket *b)
+{
+  return (inode_write_at (dir->inode, b, sizeof *b, entry_ofs (bucket, 0))
+          == sizeof *b);
+}
+
+/* Returns the name cache slot for NAME, with hash HASH, in the
+   directory whose inode is in DIR_SECTOR. */
+static struct name_cache_entry *
+name_cache_slot (block_sector_t dir_sector, unsigned hash)
+{
+  return &name_cache[(hash ^ dir_sector) % NAME_CACHE_SIZE];
+}
+
+/* Forgets any cached entry for NAME, with hash HASH, in the
+   directory whose inode is in DIR_SECTOR. */
+static void
+name_cache_forget (block_sector_t dir_sector, const char *name,
+                   unsigned hash)
+{
+  struct name_cache_entry *c = name_cache_slot (dir_sector, hash);
+
+  lock_acquire (&name_cache_lock);
+  if (c->valid && c->dir_sector == dir_sector && !strcmp (c->e.name, name))
+    c->valid = false;
+  name_cache_gen++;
+  lock_release (&name_cache_lock);
+}
+
+/* Forgets every cached entry of the directory whose inode is in
+   DIR_SECTOR. */
+static void
+name_cache_forget_dir (block_sector_t dir_sector)
+{
+  size_t i;
+
+  lock_acquire (&name_cache_lock);
+  for (i = 0; i < NAME_CACHE_SIZE; i++)
+    if (name_cache[i].dir_sector == dir_sector)
+      name_cache[i].valid = false;
+  name_cache_gen++;
+  lock_release (&name_cache_lock);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
 dir_create (block_sector_t sector, size_t entry_cnt)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  struct dir_header h;
+  struct inode *inode;
+  bool success;
+
+  /* Leave buckets half empty, so that the first names added need
+     not split them. */
+  h.bucket_cnt = 1;
+  while (h.bucket_cnt < MAX_BUCKETS
+         && h.bucket_cnt * ENTRIES_PER_BUCKET / 2 < entry_cnt)
+    h.bucket_cnt *= 2;
+
+  if (!inode_create (sector, (h.bucket_cnt + 1) * BLOCK_SECTOR_SIZE))
+    return false;
+  inode = inode_open (sector);
+  if (inode == NULL)
+    return false;
+  success = inode_write_at (inode, &h, sizeof h, 0) == sizeof h;
+  inode_close (inode);
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -92,23 +250,135 @@ static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
-  struct dir_entry e;
-  size_t ofs;
+  block_sector_t dir_sector;
+  struct name_cache_entry *c;
+  struct dir_header h, h2;
+  struct dir_bucket b;
+  unsigned hash, gen;
+  uint32_t bucket;
+  size_t i;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
+  dir_sector = inode_get_inumber (dir->inode);
+  hash = hash_string (name);
+  c = name_cache_slot (dir_sector, hash);
+
+  lock_acquire (&name_cache_lock);
+  if (c->valid && c->dir_sector == dir_sector && !strcmp (c->e.name, name))
+    {
+      if (ep != NULL)
+        *ep = c->e;
+      if (ofsp != NULL)
+        *ofsp = c->ofs;
+      lock_release (&name_cache_lock);
+      return true;
+    }
+  gen = name_cache_gen;
+  lock_release (&name_cache_lock);
+
+  /* If the directory doubled while the bucket was read, the
+     bucket may already have lost the names that moved, so look
+     again with the new header. */
+  if (!read_header (dir, &h))
+    return false;
+  for (;;)
+    {
+      bucket = hash & (h.bucket_cnt - 1);
+      if (!read_bucket (dir, bucket, &b) || !read_header (dir, &h2))
+        return false;
+      if (h2.bucket_cnt == h.bucket_cnt)
+        break;
+      h = h2;
+    }
+
+  for (i = 0; i < ENTRIES_PER_BUCKET; i++)
+    {
+      struct dir_entry *e = &b.entries[i];
+      if (e->in_use && !strcmp (name, e->name)) 
+        {
+          if (ep != NULL)
+            *ep = *e;
+          if (ofsp != NULL)
+            *ofsp = entry_ofs (bucket, i);
+
+          lock_acquire (&name_cache_lock);
+          if (gen == name_cache_gen)
+            {
+              c->valid = true;
+              c->dir_sector = dir_sector;
+              c->e = *e;
+              c->ofs = entry_ofs (bucket, i);
+            }
+          lock_release (&name_cache_lock);
+          return true;
+        }
+    }
+  return false;
+}
+
+/* Doubles the number of buckets of DIR, whose header is *H,
+   updating *H.  Returns true if successful, false on failure,
+   which leaves DIR as it was.  The caller must hold dir_lock. */
+static bool
+grow (struct dir *dir, struct dir_header *h)
+{
+  uint32_t old_cnt = h->bucket_cnt;
+  struct dir_bucket *old, *new;
+  bool success = false;
+  uint32_t bucket;
+  size_t i, n;
+
+  ASSERT (lock_held_by_current_thread (&dir_lock));
+
+  if (old_cnt >= MAX_BUCKETS)
+    return false;
+  old = malloc (sizeof *old);
+  new = malloc (sizeof *new);
+  if (old == NULL || new == NULL)
+    goto done;
+
+  /* Copy the names that move to their new buckets.  Until the
+     header changes, lookups keep finding them in the old ones. */
+  for (bucket = 0; bucket < old_cnt; bucket++)
+    {
+      if (!read_bucket (dir, bucket, old))
+        goto done;
+      memset (new, 0, sizeof *new);
+      for (i = n = 0; i < ENTRIES_PER_BUCKET; i++)
+        if (old->entries[i].in_use
+            && (hash_string (old->entries[i].name) & old_cnt))
+          new->entries[n++] = old->entries[i];
+      if (!write_bucket (dir, bucket + old_cnt, new))
+        goto done;
+    }
+
+  h->bucket_cnt = old_cnt * 2;
+  if (inode_write_at (dir->inode, h, sizeof *h, 0) != sizeof *h)
+    {
+      h->bucket_cnt = old_cnt;
+      goto done;
+    }
+  name_cache_forget_dir (inode_get_inumber (dir->inode));
+
+  /* Drop the old copies.  A failure here only leaves a stale
+     copy, which lookups no longer reach. */
+  for (bucket = 0; bucket < old_cnt; bucket++)
+    if (read_bucket (dir, bucket, old))
       {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
+        for (i = 0; i < ENTRIES_PER_BUCKET; i++)
+          if (old->entries[i].in_use
+              && (hash_string (old->entries[i].name) & old_cnt))
+            old->entries[i].in_use = false;
+        write_bucket (dir, bucket, old);
       }
-  return false;
+  success = true;
+
+ done:
+  free (old);
+  free (new);
+  return success;
 }
 
 /* Searches DIR for a file with the given NAME
@@ -141,6 +411,7 @@ dir_lookup (const struct dir *dir, const char *name,
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
+  struct dir_header h;
   struct dir_entry e;
   off_t ofs;
   bool success = false;
@@ -153,20 +424,32 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
     return false;
 
   /* Check that NAME is not in use. */
+  lock_acquire (&dir_lock);
   if (lookup (dir, name, NULL, NULL))
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+  /* Find a free slot in NAME's bucket, doubling the table
+     until there is one. */
+  if (!read_header (dir, &h))
+    goto done;
+  for (;;)
+    {
+      uint32_t bucket = hash_string (name) & (h.bucket_cnt - 1);
+      size_t i;
+
+      for (i = 0; i < ENTRIES_PER_BUCKET; i++)
+        {
+          ofs = entry_ofs (bucket, i);
+          if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+            goto done;
+          if (!e.in_use)
+            break;
+        }
+      if (i < ENTRIES_PER_BUCKET)
+        break;
+      if (!grow (dir, &h))
+        goto done;
+    }
 
   /* Write slot. */
   e.in_use = true;
@@ -175,6 +458,7 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 
  done:
+  lock_release (&dir_lock);
   return success;
 }
 
@@ -193,6 +477,7 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (name != NULL);
 
   /* Find directory entry. */
+  lock_acquire (&dir_lock);
   if (!lookup (dir, name, &e, &ofs))
     goto done;
 
@@ -205,32 +490,48 @@ dir_remove (struct dir *dir, const char *name)
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
+  name_cache_forget (inode_get_inumber (dir->inode), name,
+                     hash_string (name));
 
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  lock_release (&dir_lock);
   inode_close (inode);
   return success;
 }
 
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
-   contains no more entries. */
+   contains no more entries.  Entries come in bucket order; a
+   name added while a directory is being read may make the table
+   double, after which some names may be seen twice or not at
+   all. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
+  struct dir_header h;
   struct dir_entry e;
+  bool success = false;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
-    {
-      dir->pos += sizeof e;
-      if (e.in_use)
-        {
-          strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
-        } 
-    }
-  return false;
+  lock_acquire (&dir_lock);
+  if (read_header (dir, &h))
+    while ((uint32_t) dir->pos / ENTRIES_PER_BUCKET < h.bucket_cnt)
+      {
+        off_t ofs = entry_ofs (dir->pos / ENTRIES_PER_BUCKET,
+                               dir->pos % ENTRIES_PER_BUCKET);
+        if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+          break;
+        dir->pos++;
+        if (e.in_use)
+          {
+            strlcpy (name, e.name, NAME_MAX + 1);
+            success = true;
+            break;
+          } 
+      }
+  lock_release (&dir_lock);
+  return success;
 }
@@ -2,6 +2,7 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
@@ -12,16 +13,19 @@ struct block *fs_device;
 
 static void do_format (void);
 
-/* Initializes the file system module.
+/* Initializes the file system module, keeping up to
+   INODE_CACHE_CNT closed inodes in memory.
    If FORMAT is true, reformats the file system. */
 void
-filesys_init (bool format) 
+filesys_init (bool format, size_t inode_cache_cnt) 
 {
   fs_device = block_get_role (BLOCK_FILESYS);
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
-  inode_init ();
+  cache_init ();
+  inode_init (inode_cache_cnt);
+  dir_init ();
   free_map_init ();
 
   if (format) 
@@ -36,6 +40,15 @@ void
 filesys_done (void) 
 {
   free_map_close ();
+  cache_flush ();
+}
+
+/* Returns the sector of DIR's inode, near which the inodes of
+   its files are placed. */
+static block_sector_t
+dir_sector (struct dir *dir)
+{
+  return inode_get_inumber (dir_get_inode (dir));
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -48,7 +61,8 @@ filesys_create (const char *name, off_t initial_size)
   block_sector_t inode_sector = 0;
   struct dir *dir = dir_open_root ();
   bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
+                  && free_map_allocate_near (dir_sector (dir),
+                                             &inode_sector)
                   && inode_create (inode_sector, initial_size)
                   && dir_add (dir, name, inode_sector));
   if (!success && inode_sector != 0) 
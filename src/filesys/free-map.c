@@ -1,52 +1,205 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* The free map is one bit per sector, kept in memory and in the
+   free map file.  It is split into allocation groups of
+   GROUP_SECTORS sectors, one sector of the file each, that keep
+   a count of their free sectors, so that allocation skips full
+   groups without looking at their bits, and a hint below which
+   the group has no free sector, so that it skips the used start
+   of a group too.  A change rewrites only the part of the file
+   holding the bits changed. */
+
+/* Sectors per allocation group: the bits in one sector. */
+#define GROUP_SECTORS (BLOCK_SECTOR_SIZE * 8)
+
+struct group
+  {
+    size_t free_cnt;                  /* Free sectors in the group. */
+    block_sector_t hint;              /* No free sector below this. */
+  };
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct group *groups;         /* Allocation groups. */
+static size_t group_cnt;             /* Number of allocation groups. */
+static struct lock free_map_lock;    /* Guards all of the above. */
+
+static void count_groups (void);
 
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
-  free_map = bitmap_create (block_size (fs_device));
-  if (free_map == NULL)
+  size_t sector_cnt = block_size (fs_device);
+
+  free_map = bitmap_create (sector_cnt);
+  group_cnt = DIV_ROUND_UP (sector_cnt, GROUP_SECTORS);
+  groups = malloc (group_cnt * sizeof *groups);
+  if (free_map == NULL || groups == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  count_groups ();
+  lock_init (&free_map_lock);
 }
 
-/* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+/* Returns the first sector past group G. */
+static block_sector_t
+group_end (size_t g)
+{
+  size_t end = (g + 1) * GROUP_SECTORS;
+  return end < bitmap_size (free_map) ? end : bitmap_size (free_map);
+}
+
+/* Recomputes every group's free count and hint from the free
+   map. */
+static void
+count_groups (void)
+{
+  size_t g;
+
+  for (g = 0; g < group_cnt; g++)
+    {
+      block_sector_t start = g * GROUP_SECTORS;
+      groups[g].free_cnt = bitmap_count (free_map, start,
+                                         group_end (g) - start, false);
+      groups[g].hint = start;
+    }
+}
+
+/* Marks the CNT sectors starting at SECTOR free in the free map
+   and their groups. */
+static void
+free_sectors (block_sector_t sector, size_t cnt)
+{
+  bitmap_set_multiple (free_map, sector, cnt, false);
+  for (; cnt > 0; sector++, cnt--)
+    {
+      struct group *grp = &groups[sector / GROUP_SECTORS];
+      grp->free_cnt++;
+      if (grp->hint > sector)
+        grp->hint = sector;
+    }
+}
+
+/* Marks the first run of CNT free sectors of group G at or after
+   sector FROM as used and returns its start, or returns
+   BITMAP_ERROR if there is none.  Runs do not cross groups. */
+static block_sector_t
+allocate_in_group (size_t g, block_sector_t from, size_t cnt)
+{
+  struct group *grp = &groups[g];
+  block_sector_t end = group_end (g);
+  block_sector_t i, sector;
+  size_t run = 0;
+
+  if (grp->free_cnt < cnt)
+    return BITMAP_ERROR;
+  if (from < grp->hint)
+    from = grp->hint;
+
+  sector = BITMAP_ERROR;
+  for (i = from; i < end; i++)
+    if (bitmap_test (free_map, i))
+      run = 0;
+    else if (++run == cnt)
+      {
+        sector = i + 1 - cnt;
+        break;
+      }
+  if (sector == BITMAP_ERROR)
+    return BITMAP_ERROR;
+
+  /* Only a single sector found from the hint is known to be the
+     lowest free one. */
+  if (from == grp->hint && (cnt == 1 || sector == from))
+    grp->hint = sector + cnt;
+  bitmap_set_multiple (free_map, sector, cnt, true);
+  grp->free_cnt -= cnt;
+  return sector;
+}
+
+/* Allocates CNT consecutive sectors, looking first at or after
+   sector START, and stores the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
-bool
-free_map_allocate (size_t cnt, block_sector_t *sectorp)
+   sectors were available or if the free_map file could not be
+   written. */
+static bool
+allocate (block_sector_t start, size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+  block_sector_t sector = BITMAP_ERROR;
+  size_t first = start / GROUP_SECTORS;
+  size_t i;
+
+  lock_acquire (&free_map_lock);
+  if (cnt <= GROUP_SECTORS)
+    for (i = 0; i <= group_cnt && sector == BITMAP_ERROR; i++)
+      {
+        /* START's group, the groups after it, then those before
+           it and finally START's group from its beginning. */
+        size_t g = (first + i) % group_cnt;
+        sector = allocate_in_group (g, i == 0 ? start : g * GROUP_SECTORS,
+                                    cnt);
+      }
+  else
+    {
+      sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+      if (sector != BITMAP_ERROR)
+        for (i = 0; i < cnt; i++)
+          groups[(sector + i) / GROUP_SECTORS].free_cnt--;
+    }
+
   if (sector != BITMAP_ERROR
       && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+      && !bitmap_write_range (free_map, free_map_file, sector, cnt))
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
+      free_sectors (sector, cnt);
       sector = BITMAP_ERROR;
     }
+  lock_release (&free_map_lock);
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
 }
 
+/* Allocates CNT consecutive sectors from the free map and stores
+   the first into *SECTORP.
+   Returns true if successful, false if not enough consecutive
+   sectors were available or if the free_map file could not be
+   written. */
+bool
+free_map_allocate (size_t cnt, block_sector_t *sectorp)
+{
+  return allocate (0, cnt, sectorp);
+}
+
+/* Allocates one sector, preferring the first free one at or
+   after NEAR so that the sectors of a file end up close to its
+   inode and to each other, and stores it into *SECTORP.
+   Returns true if successful, false otherwise. */
+bool
+free_map_allocate_near (block_sector_t near, block_sector_t *sectorp)
+{
+  return allocate (near < block_size (fs_device) ? near : 0, 1, sectorp);
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  free_sectors (sector, cnt);
+  bitmap_write_range (free_map, free_map_file, sector, cnt);
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,6 +211,7 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  count_groups ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
@@ -1,23 +1,43 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Sector pointers held directly in the on-disk inode. */
+#define DIRECT_CNT 124
+
+/* Sector pointers held in an index sector. */
+#define PTRS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
+/* Largest file size, in sectors. */
+#define MAX_SECTORS (DIRECT_CNT + PTRS_PER_SECTOR \
+                     + PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+   Data sectors are found through a multi-level index: the first
+   DIRECT_CNT directly, the next PTRS_PER_SECTOR through the
+   indirect sector, and the rest through the indirect sectors
+   listed in the doubly indirect sector.  A pointer of 0 means
+   the sector is not allocated yet and reads as zeros; sector 0
+   holds the free map inode, so it is never file data. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
+    block_sector_t direct[DIRECT_CNT];  /* Data sectors. */
+    block_sector_t indirect;            /* Index of data sectors. */
+    block_sector_t doubly_indirect;     /* Index of indirect sectors. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -28,45 +48,207 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
-/* In-memory inode. */
+/* In-memory inode.  HASH_ELEM, LRU_ELEM, OPEN_CNT, REMOVED and
+   VERSION are guarded by open_inodes_lock, DENY_WRITE_CNT and the
+   file data by RW. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem hash_elem;         /* Element in open_inodes. */
+    struct list_elem lru_elem;          /* Element in closed_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
+    unsigned version;                   /* See inode_version(). */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct rw_lock rw;                  /* Readers share, writers don't. */
     struct inode_disk data;             /* Inode content. */
   };
 
+/* Allocates a sector, preferring one close to NEAR, and fills it
+   with zeros.  Returns the sector, or 0 if the disk is full. */
+static block_sector_t
+allocate_zeroed (block_sector_t near)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+  block_sector_t sector;
+
+  if (!free_map_allocate_near (near, &sector))
+    return 0;
+  cache_write_at (sector, zeros, 0, BLOCK_SECTOR_SIZE);
+  return sector;
+}
+
+/* Returns the sector pointer *SLOTP of DISK_INODE, stored in
+   sector INODE_SECTOR, first allocating a sector for it if it
+   has none and ALLOCATE.  Returns 0 if there is no sector. */
+static block_sector_t
+inode_slot (struct inode_disk *disk_inode, block_sector_t inode_sector,
+            block_sector_t *slotp, bool allocate)
+{
+  if (*slotp == 0 && allocate)
+    {
+      *slotp = allocate_zeroed (inode_sector);
+      if (*slotp != 0)
+        cache_write_at (inode_sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
+    }
+  return *slotp;
+}
+
+/* Returns pointer IDX of index sector INDEX, first allocating a
+   sector near NEAR for it if it has none and ALLOCATE.  Returns
+   0 if there is no sector. */
+static block_sector_t
+index_slot (block_sector_t index, size_t idx, block_sector_t near,
+            bool allocate)
+{
+  block_sector_t sector;
+
+  cache_read_at (index, &sector, idx * sizeof sector, sizeof sector);
+  if (sector == 0 && allocate)
+    {
+      sector = allocate_zeroed (near);
+      if (sector != 0)
+        cache_write_at (index, &sector, idx * sizeof sector, sizeof sector);
+    }
+  return sector;
+}
+
+/* Returns the sector holding byte POS of the file whose inode
+   DISK_INODE is stored in INODE_SECTOR, or 0 if there is none.
+   If ALLOCATE, the data sector and any index sectors leading to
+   it are allocated first if missing; 0 is then only returned if
+   the disk is full or POS is past the largest file size. */
+static block_sector_t
+index_lookup (struct inode_disk *disk_inode, block_sector_t inode_sector,
+              off_t pos, bool allocate)
+{
+  size_t idx = pos / BLOCK_SECTOR_SIZE;
+  block_sector_t index;
+
+  if (idx < DIRECT_CNT)
+    return inode_slot (disk_inode, inode_sector, &disk_inode->direct[idx],
+                       allocate);
+  idx -= DIRECT_CNT;
+
+  if (idx < PTRS_PER_SECTOR)
+    {
+      index = inode_slot (disk_inode, inode_sector, &disk_inode->indirect,
+                          allocate);
+      return index != 0
+             ? index_slot (index, idx, inode_sector, allocate) : 0;
+    }
+  idx -= PTRS_PER_SECTOR;
+
+  if (idx < PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+    {
+      index = inode_slot (disk_inode, inode_sector,
+                          &disk_inode->doubly_indirect, allocate);
+      if (index != 0)
+        index = index_slot (index, idx / PTRS_PER_SECTOR, inode_sector,
+                            allocate);
+      return index != 0
+             ? index_slot (index, idx % PTRS_PER_SECTOR, inode_sector,
+                           allocate)
+             : 0;
+    }
+  return 0;
+}
+
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   within INODE, allocating it if ALLOCATE.
+   Returns 0 if INODE does not have a sector for POS. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos, bool allocate) 
 {
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
-    return -1;
+  return index_lookup (&inode->data, inode->sector, pos, allocate);
+}
+
+/* Releases index sector INDEX and the LEVEL levels of sectors
+   below it. */
+static void
+release_index (block_sector_t index, int level)
+{
+  size_t i;
+
+  for (i = 0; i < PTRS_PER_SECTOR; i++)
+    {
+      block_sector_t sector;
+      cache_read_at (index, &sector, i * sizeof sector, sizeof sector);
+      if (sector == 0)
+        continue;
+      if (level > 1)
+        release_index (sector, level - 1);
+      else
+        free_map_release (sector, 1);
+    }
+  free_map_release (index, 1);
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Releases every data and index sector of DISK_INODE. */
+static void
+release_sectors (struct inode_disk *disk_inode)
+{
+  size_t i;
+
+  for (i = 0; i < DIRECT_CNT; i++)
+    if (disk_inode->direct[i] != 0)
+      free_map_release (disk_inode->direct[i], 1);
+  if (disk_inode->indirect != 0)
+    release_index (disk_inode->indirect, 1);
+  if (disk_inode->doubly_indirect != 0)
+    release_index (disk_inode->doubly_indirect, 2);
+}
 
-/* Initializes the inode module. */
+/* In-memory inodes by sector, so that opening a single inode
+   twice returns the same `struct inode'.  Besides the open
+   inodes it holds up to closed_max that were closed but not
+   removed, kept in closed_inodes from least to most recently
+   closed, so that reopening a file soon after needs no disk
+   read. */
+static struct hash open_inodes;
+static struct list closed_inodes;
+static size_t closed_cnt, closed_max;
+static struct lock open_inodes_lock;
+
+/* Last inode version handed out, guarded by open_inodes_lock. */
+static unsigned version_clock;
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
+
+/* Initializes the inode module, keeping up to CACHE_CNT closed
+   inodes in memory. */
 void
-inode_init (void) 
+inode_init (size_t cache_cnt) 
+{
+  hash_init (&open_inodes, inode_hash, inode_less, NULL);
+  list_init (&closed_inodes);
+  closed_cnt = 0;
+  closed_max = cache_cnt;
+  lock_init (&open_inodes_lock);
+}
+
+/* Returns a hash value for inode E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, hash_elem)->sector);
+}
+
+/* Returns true if inode A precedes inode B. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
 {
-  list_init (&open_inodes);
+  return (hash_entry (a, struct inode, hash_elem)->sector
+          < hash_entry (b, struct inode, hash_elem)->sector);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The LENGTH bytes are allocated, and zeroed, straight
+   away; the file grows further as it is written.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
@@ -85,21 +267,18 @@ inode_create (block_sector_t sector, off_t length)
   if (disk_inode != NULL)
     {
       size_t sectors = bytes_to_sectors (length);
+      size_t i;
+
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
+      success = sectors <= MAX_SECTORS;
+      for (i = 0; success && i < sectors; i++)
+        success = index_lookup (disk_inode, sector, i * BLOCK_SECTOR_SIZE,
+                                true) != 0;
+      if (success)
+        cache_write_at (sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
+      else
+        release_sectors (disk_inode);
       free (disk_inode);
     }
   return success;
@@ -111,33 +290,46 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct hash_elem *e;
+  struct inode key;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  /* Check whether this inode is already in memory. */
+  key.sector = sector;
+  lock_acquire (&open_inodes_lock);
+  e = hash_find (&open_inodes, &key.hash_elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
+      inode = hash_entry (e, struct inode, hash_elem);
+      if (inode->open_cnt++ == 0)
         {
-          inode_reopen (inode);
-          return inode; 
+          list_remove (&inode->lru_elem);
+          closed_cnt--;
         }
+      lock_release (&open_inodes_lock);
+      return inode; 
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize.  The lock is held until the inode is read in, so
+     that a concurrent open of the same sector cannot see it
+     half-built. */
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->version = ++version_clock;
+  rw_lock_init (&inode->rw);
+  hash_insert (&open_inodes, &inode->hash_elem);
+  cache_read_at (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -146,7 +338,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -157,31 +353,62 @@ inode_get_inumber (const struct inode *inode)
   return inode->sector;
 }
 
+/* Returns the version of INODE's contents.  It changes with every
+   write, and whenever the inode is read back into memory, when
+   the writes made meanwhile are not known; so data read from the
+   inode is current for as long as the version is the same. */
+unsigned
+inode_version (const struct inode *inode)
+{
+  return inode->version;
+}
+
 /* Closes INODE and writes it to disk.
-   If this was the last reference to INODE, frees its memory.
+   If this was the last reference to INODE, keeps it among the
+   recently closed inodes, or frees its memory if it was removed.
    If INODE was also a removed inode, frees its blocks. */
 void
 inode_close (struct inode *inode) 
 {
+  struct inode *victim = NULL;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
+  lock_acquire (&open_inodes_lock);
   if (--inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
+      if (inode->removed || closed_max == 0)
+        {
+          hash_delete (&open_inodes, &inode->hash_elem);
+          victim = inode;
+        }
+      else
+        {
+          /* Make room by dropping the least recently closed. */
+          list_push_back (&closed_inodes, &inode->lru_elem);
+          if (++closed_cnt > closed_max)
+            {
+              victim = list_entry (list_pop_front (&closed_inodes),
+                                   struct inode, lru_elem);
+              hash_delete (&open_inodes, &victim->hash_elem);
+              closed_cnt--;
+            }
+        }
+    }
+  lock_release (&open_inodes_lock);
+
+  if (victim != NULL)
+    {
       /* Deallocate blocks if removed. */
-      if (inode->removed) 
+      if (victim->removed) 
         {
-          free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          free_map_release (victim->sector, 1);
+          release_sectors (&victim->data);
         }
 
-      free (inode); 
+      free (victim); 
     }
 }
 
@@ -191,7 +418,9 @@ void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
+  lock_acquire (&open_inodes_lock);
   inode->removed = true;
+  lock_release (&open_inodes_lock);
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -202,12 +431,12 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
+  rw_lock_acquire_read (&inode->rw);
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx = byte_to_sector (inode, offset, false);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -220,23 +449,23 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
+      /* A sector skipped over by a write past the end of file
+         was never allocated and reads as zeros. */
+      if (sector_idx != 0)
+        cache_read_at (sector_idx, buffer + bytes_read, sector_ofs,
+                       chunk_size);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
+
+      /* Start loading the next sector of a read that ends in
+         this one, for the sequential reader's next call. */
+      if (size == chunk_size && sector_ofs + chunk_size == BLOCK_SECTOR_SIZE
+          && inode_left > chunk_size)
         {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+          block_sector_t next = byte_to_sector (inode, offset + chunk_size,
+                                                false);
+          if (next != 0)
+            cache_read_ahead (next);
         }
       
       /* Advance. */
@@ -244,75 +473,64 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  rw_lock_release_read (&inode->rw);
 
   return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up or an error occurs.
+   Writing past end of file extends the inode; sectors are only
+   allocated for the bytes written. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
 
+  rw_lock_acquire_write (&inode->rw);
   if (inode->deny_write_cnt)
-    return 0;
+    {
+      rw_lock_release_write (&inode->rw);
+      return 0;
+    }
 
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx = byte_to_sector (inode, offset, true);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
-
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
-
-      /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
+      if (sector_idx == 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
+      /* Number of bytes to actually write into this sector. */
+      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+      int chunk_size = size < sector_left ? size : sector_left;
 
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+      cache_write_at (sector_idx, buffer + bytes_written, sector_ofs,
+                      chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+
+  /* Extend the file over what was written past its end */
+  if (offset > inode->data.length)
+    {
+      inode->data.length = offset;
+      cache_write_at (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+    }
+  if (bytes_written > 0)
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->version = ++version_clock;
+      lock_release (&open_inodes_lock);
+    }
+  rw_lock_release_write (&inode->rw);
 
   return bytes_written;
 }
@@ -322,8 +540,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  rw_lock_acquire_write (&inode->rw);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rw_lock_release_write (&inode->rw);
 }
 
 /* Re-enables writes to INODE.
@@ -332,9 +552,11 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rw_lock_acquire_write (&inode->rw);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rw_lock_release_write (&inode->rw);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
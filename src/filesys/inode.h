@@ -2,16 +2,22 @@
 #define FILESYS_INODE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "filesys/off_t.h"
 #include "devices/block.h"
 
 struct bitmap;
 
-void inode_init (void);
+/* Default number of closed inodes kept in memory.  Overridden by
+   the -ic kernel command line option. */
+#define INODE_CACHE_DEFAULT 64
+
+void inode_init (size_t cache_cnt);
 bool inode_create (block_sector_t, off_t);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
+unsigned inode_version (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
@@ -1,5 +1,23 @@
 #include <string.h>
 #include <debug.h>
+#include <stdint.h>
+
+/* Blocks of at least WORD_MIN bytes are handled a 32-bit word at
+   a time once the destination is word aligned; shorter ones are
+   not worth the alignment prologue and go a byte at a time.
+   Blocks of at least REP_MIN bytes use the "rep" string
+   instructions, whose startup cost only pays off for long runs.
+   The kernel is built without SSE, so words are the widest unit
+   available. */
+#define WORD_MIN 16
+#define REP_MIN 256
+
+/* A word that may be unaligned and may alias any other type.
+   x86 handles unaligned loads and stores in hardware. */
+typedef uint32_t word_t __attribute__ ((__may_alias__, __aligned__ (1)));
+
+/* Nonzero if one of the four bytes of word W is zero. */
+#define HAS_ZERO_BYTE(W) (((W) - 0x01010101u) & ~(W) & 0x80808080u)
 
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
    Returns DST. */
@@ -12,6 +30,29 @@ memcpy (void *dst_, const void *src_, size_t size)
   ASSERT (dst != NULL || size == 0);
   ASSERT (src != NULL || size == 0);
 
+  if (size >= WORD_MIN) 
+    {
+      size_t words;
+
+      /* Align DST.  SRC may stay unaligned, which costs less
+         than copying bytes. */
+      for (; (uintptr_t) dst % sizeof (word_t) != 0; size--)
+        *dst++ = *src++;
+
+      words = size / sizeof (word_t);
+      size %= sizeof (word_t);
+      if (words >= REP_MIN / sizeof (word_t))
+        asm volatile ("rep movsl"
+                      : "+D" (dst), "+S" (src), "+c" (words) : : "memory");
+      else
+        for (; words > 0; words--) 
+          {
+            *(word_t *) dst = *(const word_t *) src;
+            dst += sizeof (word_t);
+            src += sizeof (word_t);
+          }
+    }
+
   while (size-- > 0)
     *dst++ = *src++;
 
@@ -58,6 +99,23 @@ memcmp (const void *a_, const void *b_, size_t size)
   ASSERT (a != NULL || size == 0);
   ASSERT (b != NULL || size == 0);
 
+  if (size >= WORD_MIN) 
+    {
+      /* Skip over equal words; the byte loop below then finds
+         the differing byte, if any, within the word that
+         stopped us. */
+      for (; (uintptr_t) a % sizeof (word_t) != 0; a++, b++, size--)
+        if (*a != *b)
+          return *a > *b ? +1 : -1;
+      for (; size >= sizeof (word_t); size -= sizeof (word_t)) 
+        {
+          if (*(const word_t *) a != *(const word_t *) b)
+            break;
+          a += sizeof (word_t);
+          b += sizeof (word_t);
+        }
+    }
+
   for (; size-- > 0; a++, b++)
     if (*a != *b)
       return *a > *b ? +1 : -1;
@@ -281,7 +339,28 @@ memset (void *dst_, int value, size_t size)
   unsigned char *dst = dst_;
 
   ASSERT (dst != NULL || size == 0);
-  
+
+  if (size >= WORD_MIN) 
+    {
+      uint32_t word = (unsigned char) value * 0x01010101u;
+      size_t words;
+
+      for (; (uintptr_t) dst % sizeof (word_t) != 0; size--)
+        *dst++ = value;
+
+      words = size / sizeof (word_t);
+      size %= sizeof (word_t);
+      if (words >= REP_MIN / sizeof (word_t))
+        asm volatile ("rep stosl"
+                      : "+D" (dst), "+c" (words) : "a" (word) : "memory");
+      else
+        for (; words > 0; words--) 
+          {
+            *(word_t *) dst = word;
+            dst += sizeof (word_t);
+          }
+    }
+
   while (size-- > 0)
     *dst++ = value;
 
@@ -296,7 +375,16 @@ strlen (const char *string)
 
   ASSERT (string != NULL);
 
-  for (p = string; *p != '\0'; p++)
+  /* Once P is aligned, scan a word at a time.  An aligned word
+     never straddles a page boundary, so reading the bytes past
+     the terminator in the last word cannot fault. */
+  for (p = string; (uintptr_t) p % sizeof (word_t) != 0; p++)
+    if (*p == '\0')
+      return p - string;
+  while (!HAS_ZERO_BYTE (*(const word_t *) p))
+    p += sizeof (word_t);
+
+  for (; *p != '\0'; p++)
     continue;
   return p - string;
 }
@@ -53,6 +53,8 @@ static const struct test tests[] =
     {"mlfqs-nice-2", test_mlfqs_nice_2},
     {"mlfqs-nice-10", test_mlfqs_nice_10},
     {"mlfqs-block", test_mlfqs_block},
+    {"sched-latency", test_sched_latency},
+    {"string-speed", test_string_speed},
   };  
 #endif
 
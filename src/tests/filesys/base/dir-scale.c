@@ -0,0 +1,58 @@
+/* Creates FILE_CNT empty files in the root directory, opens each
+   of them by name, then removes them all, checking that no name
+   is lost or found twice along the way.  The whole sequence is
+   timed, for dir-scale.ck to work out the rate of directory
+   operations. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 20000
+
+static void
+make_name (char name[16], int i) 
+{
+  snprintf (name, 16, "f%d", i);
+}
+
+void
+test_main (void) 
+{
+  char name[16];
+  int start;
+  int fd;
+  int i;
+
+  start = ticks ();
+  msg ("create %d files", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      make_name (name, i);
+      if (!create (name, 0))
+        fail ("create \"%s\"", name);
+    }
+
+  msg ("open each file");
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      make_name (name, i);
+      fd = open (name);
+      if (fd < 2)
+        fail ("open \"%s\"", name);
+      close (fd);
+    }
+
+  msg ("remove each file");
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      make_name (name, i);
+      if (!remove (name))
+        fail ("remove \"%s\"", name);
+      if (open (name) != -1)
+        fail ("open \"%s\" after removal", name);
+    }
+  msg ("workload took %d ticks", ticks () - start);
+  CHECK (create ("f0", 0), "create \"f0\" again");
+}
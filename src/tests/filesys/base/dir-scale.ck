@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+my (@core) = get_core_output ("run", @output);
+fail "missing end in output"
+  unless grep ($_ eq '(dir-scale) end', @core);
+
+my ($secs) = get_workload_secs ("run", @core);
+
+# Each file is created, opened and removed, then looked up again.
+my ($ops) = 4 * 20000;
+
+pass sprintf ("%d directory operations in %.2f s, %.0f ops/s",
+	      $ops, $secs, $ops / $secs);
@@ -151,6 +151,18 @@ sub get_core_output {
     return @output[$start...$end];
 }
 
+# Returns the seconds taken by the workload that the test timed
+# itself and reported in @core as "(test) workload took N ticks".
+sub get_workload_secs {
+    my ($run, @core) = @_;
+    my ($ticks) = map (/^\(\S+\) workload took (\d+) ticks$/, @core);
+    fail "\u$run didn't report its workload time\n" if !defined $ticks;
+
+    # TIMER_FREQ is 100 Hz.  A workload shorter than one tick
+    # still took some time, so count it as one.
+    return ($ticks > 0 ? $ticks : 1) / 100;
+}
+
 sub compare_output {
     my ($run) = shift @_;
     my ($expected) = pop @_;
@@ -0,0 +1,110 @@
+/* Measures the cost of a context switch as the number of threads
+   waiting in the run queue grows.
+
+   Two threads ping-pong through a pair of semaphores while a
+   varying number of lower-priority threads sit in the ready
+   queue.  With a list scan in next_thread_to_run() the switch
+   cost grows linearly with the queue depth; with the per-priority
+   run queue it should stay flat. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define ITER_CNT 1000           /* Ping-pong round trips per depth. */
+
+static const int depths[] = {0, 16, 64, 256};
+
+static struct semaphore ping, pong;
+static bool done;
+
+static thread_func partner_thread;
+static thread_func filler_thread;
+
+/* Returns the CPU's time-stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+void
+test_sched_latency (void) 
+{
+  size_t d;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  for (d = 0; d < sizeof depths / sizeof *depths; d++) 
+    {
+      uint64_t start, cycles;
+      int i;
+
+      /* Fill the run queue with threads that cannot preempt us,
+         spread across all the lower priority levels. */
+      for (i = 0; i < depths[d]; i++) 
+        {
+          char name[16];
+          snprintf (name, sizeof name, "filler %d", i);
+          thread_create (name, PRI_MIN + 1 + i % (PRI_DEFAULT - PRI_MIN - 1),
+                         filler_thread, NULL);
+        }
+      if (threads_ready () != (size_t) depths[d])
+        fail ("%zu threads ready, expected %d", threads_ready (), depths[d]);
+
+      sema_init (&ping, 0);
+      sema_init (&pong, 0);
+      done = false;
+      thread_create ("partner", PRI_DEFAULT + 1, partner_thread, NULL);
+
+      /* Each round trip is two context switches. */
+      start = rdtsc ();
+      for (i = 0; i < ITER_CNT; i++) 
+        {
+          sema_up (&ping);
+          sema_down (&pong);
+        }
+      cycles = rdtsc () - start;
+
+      done = true;
+      sema_up (&ping);
+
+      msg ("ready queue depth %3d: %5"PRIu64" cycles per switch",
+           depths[d], cycles / (2 * ITER_CNT));
+
+      /* Let the fillers run to completion. */
+      thread_set_priority (PRI_MIN);
+      thread_set_priority (PRI_DEFAULT);
+      if (threads_ready () != 0)
+        fail ("%zu threads still ready after draining", threads_ready ());
+    }
+  pass ();
+}
+
+static void
+partner_thread (void *aux UNUSED) 
+{
+  for (;;) 
+    {
+      sema_down (&ping);
+      if (done)
+        break;
+      sema_up (&pong);
+    }
+}
+
+static void
+filler_thread (void *aux UNUSED) 
+{
+}
@@ -0,0 +1,148 @@
+/* Measures the throughput of memcpy(), memset(), memcmp() and
+   strlen() for a range of block sizes, in bytes per cycle, after
+   checking each against a byte-at-a-time reference at every
+   alignment.
+
+   The small sizes show the cost of the per-call setup, the page
+   sized ones the speed of the word loops and string instructions
+   that page zeroing, page copies and file reads rely on. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+#define ITER_CNT 1000           /* Calls timed per size. */
+#define CHECK_MAX 300           /* Largest size checked exhaustively. */
+
+static const size_t sizes[] = {8, 64, 512, PGSIZE};
+
+static uint8_t *src, *dst;
+
+static void check_primitives (void);
+static void report (const char *, size_t size, uint64_t cycles);
+
+/* Returns the CPU's time-stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+void
+test_string_speed (void) 
+{
+  size_t s;
+
+  src = palloc_get_page (PAL_ASSERT);
+  dst = palloc_get_page (PAL_ASSERT);
+
+  check_primitives ();
+
+  for (s = 0; s < sizeof sizes / sizeof *sizes; s++) 
+    {
+      size_t size = sizes[s];
+      uint64_t start;
+      size_t len = 0;
+      int diff = 0;
+      int i;
+
+      memset (src, 'x', PGSIZE);
+      src[size - 1] = '\0';
+
+      start = rdtsc ();
+      for (i = 0; i < ITER_CNT; i++)
+        memcpy (dst, src, size);
+      report ("memcpy", size, rdtsc () - start);
+
+      start = rdtsc ();
+      for (i = 0; i < ITER_CNT; i++)
+        diff |= memcmp (dst, src, size);
+      report ("memcmp", size, rdtsc () - start);
+
+      start = rdtsc ();
+      for (i = 0; i < ITER_CNT; i++)
+        len += strlen ((const char *) src);
+      report ("strlen", size, rdtsc () - start);
+
+      start = rdtsc ();
+      for (i = 0; i < ITER_CNT; i++)
+        memset (dst, i, size);
+      report ("memset", size, rdtsc () - start);
+
+      if (diff != 0 || len != (size - 1) * ITER_CNT)
+        fail ("wrong result timing %zu byte blocks", size);
+    }
+
+  palloc_free_page (src);
+  palloc_free_page (dst);
+  pass ();
+}
+
+/* Checks each primitive against a plain byte loop for every size
+   up to CHECK_MAX and every alignment of its arguments. */
+static void
+check_primitives (void) 
+{
+  size_t size, src_ofs, dst_ofs, i;
+
+  for (i = 0; i < PGSIZE; i++)
+    src[i] = i * 7 + 1;
+
+  for (size = 0; size <= CHECK_MAX; size++)
+    for (src_ofs = 0; src_ofs < 4; src_ofs++)
+      for (dst_ofs = 0; dst_ofs < 4; dst_ofs++) 
+        {
+          uint8_t *s = src + src_ofs, *d = dst + dst_ofs;
+
+          memset (dst, 0, PGSIZE);
+          memcpy (d, s, size);
+          for (i = 0; i < size; i++)
+            if (d[i] != s[i])
+              fail ("memcpy of %zu bytes from +%zu to +%zu wrong at %zu",
+                    size, src_ofs, dst_ofs, i);
+          if ((dst_ofs > 0 && d[-1] != 0) || d[size] != 0)
+            fail ("memcpy of %zu bytes to +%zu overran", size, dst_ofs);
+
+          if (memcmp (d, s, size) != 0)
+            fail ("memcmp of %zu equal bytes not zero", size);
+          if (size > 0) 
+            {
+              int expect;
+
+              d[size - 1] ^= 0x80;
+              expect = d[size - 1] > s[size - 1] ? 1 : -1;
+              if (memcmp (d, s, size) != expect
+                  || memcmp (s, d, size) != -expect)
+                fail ("memcmp of %zu bytes missed last byte", size);
+              d[size - 1] ^= 0x80;
+            }
+
+          memset (dst, 0, PGSIZE);
+          memset (d, 0xa5, size);
+          for (i = 0; i < PGSIZE; i++)
+            if (dst[i] != (i >= dst_ofs && i < dst_ofs + size ? 0xa5 : 0))
+              fail ("memset of %zu bytes at +%zu wrong at %zu",
+                    size, dst_ofs, i);
+
+          d[size] = '\0';
+          if (strlen ((const char *) d) != size)
+            fail ("strlen of %zu bytes at +%zu wrong", size, dst_ofs);
+        }
+}
+
+/* Prints the throughput of ITER_CNT calls on SIZE byte blocks
+   that took CYCLES in total, as bytes per cycle to two decimal
+   places. */
+static void
+report (const char *name, size_t size, uint64_t cycles) 
+{
+  uint64_t rate = (uint64_t) size * ITER_CNT * 100 / (cycles + 1);
+
+  msg ("%s %4zu bytes: %3"PRIu64".%02"PRIu64" bytes per cycle",
+       name, size, rate / 100, rate % 100);
+}
@@ -0,0 +1,34 @@
+/* Child process of page-share-data.
+   Checks its initialized data, then overwrites every other page
+   of it and checks that it reads back, while the untouched pages
+   may still be shared with the other children. */
+
+#include "tests/lib.h"
+#include "tests/main.h"
+
+const char *test_name = "child-data";
+
+#define SIZE (256 * 1024)
+#define PAGE 4096
+
+static char data[SIZE] = { [0 ... SIZE - 1] = 0x3c };
+
+int
+main (int argc, char *argv[])
+{
+  char value = argv[argc - 1][0];
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (data[i] != 0x3c)
+      return 1;
+
+  for (i = 0; i < SIZE; i += 2 * PAGE)
+    data[i] = value;
+
+  for (i = 0; i < SIZE; i++)
+    if (data[i] != (i % (2 * PAGE) == 0 ? value : 0x3c))
+      return 2;
+
+  return 0x42;
+}
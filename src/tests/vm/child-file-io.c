@@ -0,0 +1,47 @@
+/* Child process of file-io-scale.
+   Creates a 64 kB file of its own, then several times over
+   rewrites it and reads it back, checking the contents. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+const char *test_name = "child-file-io";
+
+#define FILE_SIZE (64 * 1024)
+#define ROUNDS 8
+
+static unsigned char buf[FILE_SIZE];
+
+int
+main (int argc UNUSED, char *argv[]) 
+{
+  int handle;
+  int round;
+  size_t i;
+
+  quiet = true;
+
+  CHECK (create (argv[1], FILE_SIZE), "create \"%s\"", argv[1]);
+  CHECK ((handle = open (argv[1])) > 1, "open \"%s\"", argv[1]);
+
+  for (round = 0; round < ROUNDS; round++)
+    {
+      for (i = 0; i < FILE_SIZE; i++)
+        buf[i] = (unsigned char) (i + round);
+      seek (handle, 0);
+      CHECK (write (handle, buf, FILE_SIZE) == FILE_SIZE,
+             "write \"%s\"", argv[1]);
+
+      seek (handle, 0);
+      CHECK (read (handle, buf, FILE_SIZE) == FILE_SIZE,
+             "read \"%s\"", argv[1]);
+      for (i = 0; i < FILE_SIZE; i++)
+        if (buf[i] != (unsigned char) (i + round))
+          fail ("byte %zu of \"%s\" differs in round %d",
+                i, argv[1], round);
+    }
+  close (handle);
+
+  return 0x42;
+}
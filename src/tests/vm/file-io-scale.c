@@ -0,0 +1,32 @@
+/* Runs 8 child-file-io processes at once, each writing and
+   reading back a file of its own, so that file I/O on unrelated
+   files overlaps.  The children are timed from the first exec
+   to the last wait, for file-io-scale.ck to work out the
+   throughput. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHILD_CNT 8
+
+void
+test_main (void)
+{
+  pid_t children[CHILD_CNT];
+  int start;
+  int i;
+
+  start = ticks ();
+  for (i = 0; i < CHILD_CNT; i++) 
+    {
+      char cmd[128];
+      snprintf (cmd, sizeof cmd, "child-file-io fio%d", i);
+      CHECK ((children[i] = exec (cmd)) != -1, "exec \"%s\"", cmd);
+    }
+
+  for (i = 0; i < CHILD_CNT; i++) 
+    CHECK (wait (children[i]) == 0x42, "wait for child %d", i);
+  msg ("workload took %d ticks", ticks () - start);
+}
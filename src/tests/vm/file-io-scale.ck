@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+my (@core) = get_core_output ("run", @output);
+fail "missing end in output"
+  unless grep ($_ eq '(file-io-scale) end', @core);
+
+my ($secs) = get_workload_secs ("run", @core);
+
+# 8 children each write and read back 64 kB 8 times.
+my ($kb) = 8 * 8 * 2 * 64;
+
+pass sprintf ("%d kB of file I/O in %.2f s, %.0f kB/s",
+	      $kb, $secs, $kb / $secs);
@@ -0,0 +1,66 @@
+/* Fills a buffer, then forks CHILD_CNT children at once.  Each
+   child checks that it sees the parent's data, overwrites a few
+   pages of it with its own and checks those, while the parent
+   checks that its data is unchanged by the children.  Forking
+   from a warmed-up parent should cost little, since memory is
+   only copied where it is written.  The forks and waits are
+   timed, for fork-cow.ck to work out the cost of a fork. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHILD_CNT 16
+#define SIZE (512 * 1024)
+#define STRIDE (64 * 1024)
+
+static char buf[SIZE];
+
+/* Returns true if BUF holds byte VALUE at every offset from START
+   in steps of STEP. */
+static bool
+holds (size_t start, size_t step, char value)
+{
+  size_t i;
+
+  for (i = start; i < SIZE; i += step)
+    if (buf[i] != value)
+      return false;
+  return true;
+}
+
+void
+test_main (void)
+{
+  pid_t children[CHILD_CNT];
+  int start;
+  int i;
+
+  memset (buf, 0x5a, SIZE);
+
+  start = ticks ();
+
+  for (i = 0; i < CHILD_CNT; i++)
+    {
+      children[i] = fork ();
+      if (children[i] == 0)
+        {
+          size_t ofs;
+
+          if (!holds (0, 1, 0x5a))
+            exit (1);
+          for (ofs = i * 4096; ofs < SIZE; ofs += STRIDE)
+            buf[ofs] = i;
+          if (!holds (i * 4096, STRIDE, i))
+            exit (2);
+          exit (0x42);
+        }
+      CHECK (children[i] != -1, "fork child %d", i);
+    }
+
+  for (i = 0; i < CHILD_CNT; i++)
+    CHECK (wait (children[i]) == 0x42, "wait for child %d", i);
+  msg ("workload took %d ticks", ticks () - start);
+  CHECK (holds (0, 1, 0x5a), "parent's data unchanged");
+}
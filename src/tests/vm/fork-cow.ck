@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+my (@core) = get_core_output ("run", @output);
+fail "missing end in output"
+  unless grep ($_ eq '(fork-cow) end', @core);
+
+my ($secs) = get_workload_secs ("run", @core);
+my ($faults) = map (/Exception: (\d+) page faults/, @output);
+fail "missing page fault count in output" unless defined $faults;
+
+# 16 forks of a 512 kB data segment.
+pass sprintf ("16 forks with %d page faults in %.2f s",
+	      $faults, $secs);
@@ -0,0 +1,38 @@
+/* Maps a file and reads it, rewrites the file with the write
+   system call, then maps it again elsewhere and checks that the
+   new mapping shows the new contents rather than the page that
+   is still in memory from the first mapping. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FIRST ((char *) 0x10000000)
+#define SECOND ((char *) 0x20000000)
+#define SIZE 4096
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  int handle;
+  mapid_t map;
+
+  CHECK (create ("data", SIZE), "create \"data\"");
+  CHECK ((handle = open ("data")) > 1, "open \"data\"");
+  memset (buf, 'a', SIZE);
+  CHECK (write (handle, buf, SIZE) == SIZE, "write \"data\"");
+  CHECK ((map = mmap (handle, FIRST)) != MAP_FAILED, "mmap \"data\"");
+  CHECK (FIRST[0] == 'a' && FIRST[SIZE - 1] == 'a', "check mapping");
+  munmap (map);
+
+  memset (buf, 'b', SIZE);
+  seek (handle, 0);
+  CHECK (write (handle, buf, SIZE) == SIZE, "rewrite \"data\"");
+  CHECK ((map = mmap (handle, SECOND)) != MAP_FAILED, "mmap \"data\" again");
+  CHECK (!memcmp (SECOND, buf, SIZE), "check new mapping");
+  munmap (map);
+  close (handle);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-rewrite) begin
+(mmap-rewrite) create "data"
+(mmap-rewrite) open "data"
+(mmap-rewrite) write "data"
+(mmap-rewrite) mmap "data"
+(mmap-rewrite) check mapping
+(mmap-rewrite) rewrite "data"
+(mmap-rewrite) mmap "data" again
+(mmap-rewrite) check new mapping
+(mmap-rewrite) end
+EOF
+pass;
@@ -0,0 +1,28 @@
+/* Runs 8 child-linear processes at once, so that page faults
+   and evictions in different processes overlap.  The children
+   are timed from the first exec to the last wait, and
+   page-fault-rate.ck works out the fault rate from that and the
+   kernel's statistics at shutdown. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHILD_CNT 8
+
+void
+test_main (void)
+{
+  pid_t children[CHILD_CNT];
+  int start;
+  int i;
+
+  start = ticks ();
+  for (i = 0; i < CHILD_CNT; i++) 
+    CHECK ((children[i] = exec ("child-linear")) != -1,
+           "exec \"child-linear\"");
+
+  for (i = 0; i < CHILD_CNT; i++) 
+    CHECK (wait (children[i]) == 0x42, "wait for child %d", i);
+  msg ("workload took %d ticks", ticks () - start);
+}
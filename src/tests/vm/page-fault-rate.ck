@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+my (@core) = get_core_output ("run", @output);
+fail "missing end in output"
+  unless grep ($_ eq '(page-fault-rate) end', @core);
+
+my ($secs) = get_workload_secs ("run", @core);
+my ($faults) = map (/Exception: (\d+) page faults/, @output);
+fail "missing page fault count in output" unless defined $faults;
+
+pass sprintf ("%d page faults in %.2f s, %.0f faults/s",
+	      $faults, $secs, $faults / $secs);
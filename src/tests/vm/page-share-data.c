@@ -0,0 +1,28 @@
+/* Runs 8 child-data processes at once.  Their initialized data
+   pages are shared until written, so each child must still see
+   the file's contents where it did not write, and only its own
+   values where it did. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHILD_CNT 8
+
+void
+test_main (void)
+{
+  pid_t children[CHILD_CNT];
+  int i;
+
+  for (i = 0; i < CHILD_CNT; i++) 
+    {
+      char cmd[32];
+      snprintf (cmd, sizeof cmd, "child-data %c", 'a' + i);
+      CHECK ((children[i] = exec (cmd)) != -1, "exec \"%s\"", cmd);
+    }
+
+  for (i = 0; i < CHILD_CNT; i++) 
+    CHECK (wait (children[i]) == 0x42, "wait for child %d", i);
+}
@@ -0,0 +1,25 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-share-data) begin
+(page-share-data) exec "child-data a"
+(page-share-data) exec "child-data b"
+(page-share-data) exec "child-data c"
+(page-share-data) exec "child-data d"
+(page-share-data) exec "child-data e"
+(page-share-data) exec "child-data f"
+(page-share-data) exec "child-data g"
+(page-share-data) exec "child-data h"
+(page-share-data) wait for child 0
+(page-share-data) wait for child 1
+(page-share-data) wait for child 2
+(page-share-data) wait for child 3
+(page-share-data) wait for child 4
+(page-share-data) wait for child 5
+(page-share-data) wait for child 6
+(page-share-data) wait for child 7
+(page-share-data) end
+EOF
+pass;
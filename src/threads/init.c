@@ -37,6 +37,12 @@
 #include "devices/ide.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/inode.h"
+#endif
+#ifdef VM
+#include "vm/cleaner.h"
+#include "vm/mmap.h"
+#include "vm/spt.h"
 #endif
 
 /* Page directory with kernel mappings only. */
@@ -53,11 +59,20 @@ static const char *scratch_bdev_name;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
+
+/* -ic: Number of closed inodes to keep in memory. */
+static size_t inode_cache_cnt = INODE_CACHE_DEFAULT;
 #endif /* FILESYS */
 
 /* -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
+#ifdef VM
+/* -cl, -ch: Low and high watermarks of the page cleaner. */
+static size_t cleaner_low = CLEANER_LOW_DEFAULT;
+static size_t cleaner_high = CLEANER_HIGH_DEFAULT;
+#endif
+
 static void bss_init (void);
 static void paging_init (void);
 
@@ -99,6 +114,10 @@ main (void)
   palloc_init (user_page_limit);
   malloc_init ();
   paging_init ();
+#ifdef VM
+  spt_init ();
+  mmap_init ();
+#endif
 
   /* Segmentation. */
 #ifdef USERPROG
@@ -125,8 +144,11 @@ main (void)
   /* Initialize file system. */
   ide_init ();
   locate_block_devices ();
-  filesys_init (format_filesys);
+  filesys_init (format_filesys, inode_cache_cnt);
   swap_init();
+#ifdef VM
+  cleaner_init (cleaner_low, cleaner_high);
+#endif
 #endif
 
   printf ("Boot complete.\n");
@@ -249,6 +271,8 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-ic"))
+        inode_cache_cnt = atoi (value);
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -261,6 +285,12 @@ parse_options (char **argv)
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-cl"))
+        cleaner_low = atoi (value);
+      else if (!strcmp (name, "-ch"))
+        cleaner_high = atoi (value);
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -375,6 +405,7 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -ic=COUNT          Keep COUNT closed inodes in memory.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
@@ -383,6 +414,10 @@ usage (void)
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+          "  -cl=COUNT          Wake the page cleaner below COUNT clean frames.\n"
+          "  -ch=COUNT          Page cleaner target of clean frames (0 = off).\n"
 #endif
           );
   shutdown_power_off ();
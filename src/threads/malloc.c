@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -32,7 +33,24 @@
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.
+
+   In front of each descriptor's free list sits a "magazine", a
+   small stack of free blocks that is guarded by disabling
+   interrupts rather than by the descriptor's lock, which with
+   priority donation is costly even when nobody else holds it.
+   malloc() and free() use only the magazine when they can.  An
+   empty magazine is refilled with a batch of blocks from the free
+   list, and a full one drained by a batch, under the lock.
+   Blocks in a magazine count as in use in their arenas.
+
+   Objects allocated often and of one known size are better kept
+   in an object cache, see kmem_cache_create() below. */
+
+/* Most blocks in a magazine, and blocks moved between a
+   magazine and its free list at a time. */
+#define MAG_SIZE 16
+#define MAG_BATCH (MAG_SIZE / 2)
 
 /* Descriptor. */
 struct desc
@@ -41,6 +59,8 @@ struct desc
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
     struct list free_list;      /* List of free blocks. */
     struct lock lock;           /* Lock. */
+    struct block *mag[MAG_SIZE]; /* Magazine of free blocks. */
+    size_t mag_cnt;             /* Number of blocks in MAG. */
   };
 
 /* Magic number for detecting arena corruption. */
@@ -66,6 +86,57 @@ static size_t desc_cnt;         /* Number of descriptors. */
 
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static size_t take_blocks (struct desc *, struct block **, size_t cnt);
+static void release_blocks (struct desc *, struct block **, size_t cnt);
+
+/* Object caches.
+
+   A cache hands out objects of one exact size, rounded up only
+   to pointer alignment, from "slabs" of one page each.  A slab
+   starts with a header and a stack of the indexes of its free
+   objects, followed by the objects.  Slabs with free objects are
+   kept on the cache's list; full slabs are on no list and are
+   found again from an object's address when it is freed.  Every
+   cache has a lock of its own.
+
+   A constructor, if given, is run on each object once, when its
+   slab is created, and an object must be given back to the cache
+   in its constructed state.  Keeping the free stack outside the
+   objects leaves them untouched while they are free. */
+struct kmem_cache
+  {
+    const char *name;           /* For statistics. */
+    size_t obj_size;            /* Size of each object in bytes. */
+    size_t objs_per_slab;       /* Number of objects in a slab. */
+    size_t obj_ofs;             /* Offset of first object in a slab. */
+    void (*ctor) (void *);      /* Constructor, or null. */
+    struct list slabs;          /* Slabs with free objects. */
+    struct lock lock;           /* Lock. */
+
+    /* Statistics. */
+    size_t slab_cnt;            /* Slabs allocated. */
+    size_t in_use_cnt;          /* Objects allocated and not freed. */
+    long long alloc_cnt;        /* Objects ever allocated. */
+  };
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Slab header, at the start of each slab's page. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct kmem_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* In cache's list if not full. */
+    size_t free_cnt;            /* Number of free objects. */
+    uint16_t free[];            /* Indexes of free objects. */
+  };
+
+/* All the caches there are.  Caches are never destroyed, and are
+   created before malloc() may be used, so they are kept in a
+   fixed array. */
+static struct kmem_cache caches[16];
+static size_t cache_cnt;
 
 /* Initializes the malloc() descriptors. */
 void
@@ -81,6 +152,7 @@ malloc_init (void)
       d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
       list_init (&d->free_list);
       lock_init (&d->lock);
+      d->mag_cnt = 0;
     }
 }
 
@@ -92,6 +164,9 @@ malloc (size_t size)
   struct desc *d;
   struct block *b;
   struct arena *a;
+  struct block *batch[MAG_BATCH];
+  enum intr_level old_level;
+  size_t cnt;
 
   /* A null pointer satisfies a request for 0 bytes. */
   if (size == 0)
@@ -119,6 +194,43 @@ malloc (size_t size)
       return a + 1;
     }
 
+  /* Take a block from the magazine if it has one. */
+  old_level = intr_disable ();
+  if (d->mag_cnt > 0)
+    {
+      b = d->mag[--d->mag_cnt];
+      intr_set_level (old_level);
+      return b;
+    }
+  intr_set_level (old_level);
+
+  /* Otherwise take a batch from the free list, keep one block and
+     put the rest in the magazine.  Another thread may have
+     filled the magazine meanwhile, so any blocks that do not fit
+     go back. */
+  cnt = take_blocks (d, batch, MAG_BATCH);
+  if (cnt == 0)
+    return NULL;
+  b = batch[--cnt];
+
+  old_level = intr_disable ();
+  while (cnt > 0 && d->mag_cnt < MAG_SIZE)
+    d->mag[d->mag_cnt++] = batch[--cnt];
+  intr_set_level (old_level);
+  if (cnt > 0)
+    release_blocks (d, batch, cnt);
+  return b;
+}
+
+/* Takes up to CNT blocks from D's free list into BLOCKS, creating
+   an arena if the list is empty, and returns the number taken.
+   Returns 0 only if memory is not available. */
+static size_t
+take_blocks (struct desc *d, struct block **blocks, size_t cnt)
+{
+  struct arena *a;
+  size_t taken;
+
   lock_acquire (&d->lock);
 
   /* If the free list is empty, create a new arena. */
@@ -131,7 +243,7 @@ malloc (size_t size)
       if (a == NULL) 
         {
           lock_release (&d->lock);
-          return NULL; 
+          return 0; 
         }
 
       /* Initialize arena and add its blocks to the free list. */
@@ -145,12 +257,51 @@ malloc (size_t size)
         }
     }
 
-  /* Get a block from free list and return it. */
-  b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-  a = block_to_arena (b);
-  a->free_cnt--;
+  /* Get blocks from the free list. */
+  for (taken = 0; taken < cnt && !list_empty (&d->free_list); taken++)
+    {
+      struct block *b = list_entry (list_pop_front (&d->free_list),
+                                    struct block, free_elem);
+      a = block_to_arena (b);
+      a->free_cnt--;
+      blocks[taken] = b;
+    }
+  lock_release (&d->lock);
+  return taken;
+}
+
+/* Returns the CNT blocks in BLOCKS to D's free list, giving back
+   to the page allocator any arena that is left with no blocks in
+   use. */
+static void
+release_blocks (struct desc *d, struct block **blocks, size_t cnt)
+{
+  size_t i;
+
+  lock_acquire (&d->lock);
+  for (i = 0; i < cnt; i++)
+    {
+      struct block *b = blocks[i];
+      struct arena *a = block_to_arena (b);
+
+      /* Add block to free list. */
+      list_push_front (&d->free_list, &b->free_elem);
+
+      /* If the arena is now entirely unused, free it. */
+      if (++a->free_cnt >= d->blocks_per_arena) 
+        {
+          size_t j;
+
+          ASSERT (a->free_cnt == d->blocks_per_arena);
+          for (j = 0; j < d->blocks_per_arena; j++) 
+            {
+              struct block *b = arena_to_block (a, j);
+              list_remove (&b->free_elem);
+            }
+          palloc_free_page (a);
+        }
+    }
   lock_release (&d->lock);
-  return b;
 }
 
 /* Allocates and return A times B bytes initialized to zeroes.
@@ -233,26 +384,19 @@ free (void *p)
           memset (b, 0xcc, d->block_size);
 #endif
   
-          lock_acquire (&d->lock);
-
-          /* Add block to free list. */
-          list_push_front (&d->free_list, &b->free_elem);
-
-          /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena) 
-            {
-              size_t i;
-
-              ASSERT (a->free_cnt == d->blocks_per_arena);
-              for (i = 0; i < d->blocks_per_arena; i++) 
-                {
-                  struct block *b = arena_to_block (a, i);
-                  list_remove (&b->free_elem);
-                }
-              palloc_free_page (a);
-            }
-
-          lock_release (&d->lock);
+          /* Put the block in the magazine, first draining a
+             batch of blocks to the free list if it is full. */
+          struct block *batch[MAG_BATCH];
+          size_t cnt = 0;
+          enum intr_level old_level = intr_disable ();
+          if (d->mag_cnt >= MAG_SIZE)
+            for (; cnt < MAG_BATCH; cnt++)
+              batch[cnt] = d->mag[--d->mag_cnt];
+          d->mag[d->mag_cnt++] = b;
+          intr_set_level (old_level);
+
+          if (cnt > 0)
+            release_blocks (d, batch, cnt);
         }
       else
         {
@@ -292,3 +436,148 @@ arena_to_block (struct arena *a, size_t idx)
                            + sizeof *a
                            + idx * a->desc->block_size);
 }
+
+/* Creates and returns a cache of objects of SIZE bytes named
+   NAME, which must not be freed.  If CTOR is nonnull it is run on
+   each object when the object's slab is created, see above.  May
+   be called before malloc_init(). */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, void (*ctor) (void *))
+{
+  struct kmem_cache *c;
+  size_t per_obj;
+
+  ASSERT (cache_cnt < sizeof caches / sizeof *caches);
+  ASSERT (size > 0);
+
+  c = &caches[cache_cnt++];
+  c->name = name;
+  c->obj_size = ROUND_UP (size, sizeof (void *));
+  per_obj = c->obj_size + sizeof (uint16_t);
+  c->objs_per_slab = (PGSIZE - sizeof (struct slab)) / per_obj;
+  c->obj_ofs = ROUND_UP (sizeof (struct slab)
+                         + c->objs_per_slab * sizeof (uint16_t),
+                         sizeof (void *));
+  while (c->obj_ofs + c->objs_per_slab * c->obj_size > PGSIZE)
+    c->objs_per_slab--;
+  ASSERT (c->objs_per_slab > 0);
+  c->ctor = ctor;
+  list_init (&c->slabs);
+  lock_init (&c->lock);
+  c->slab_cnt = c->in_use_cnt = 0;
+  c->alloc_cnt = 0;
+  return c;
+}
+
+/* Returns object IDX of slab S. */
+static void *
+slab_obj (struct slab *s, size_t idx)
+{
+  return (uint8_t *) s + s->cache->obj_ofs + idx * s->cache->obj_size;
+}
+
+/* Obtains and returns an object from cache C.  Returns a null
+   pointer if memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  lock_acquire (&c->lock);
+
+  /* If no slab has a free object, create one. */
+  if (list_empty (&c->slabs))
+    {
+      size_t i;
+
+      s = palloc_get_page (0);
+      if (s == NULL)
+        {
+          lock_release (&c->lock);
+          return NULL;
+        }
+      s->magic = SLAB_MAGIC;
+      s->cache = c;
+      s->free_cnt = c->objs_per_slab;
+      for (i = 0; i < c->objs_per_slab; i++)
+        {
+          s->free[i] = c->objs_per_slab - 1 - i;
+          if (c->ctor != NULL)
+            c->ctor (slab_obj (s, i));
+        }
+      list_push_front (&c->slabs, &s->elem);
+      c->slab_cnt++;
+    }
+
+  /* Take an object from the first slab, dropping the slab from
+     the list once it is full. */
+  s = list_entry (list_front (&c->slabs), struct slab, elem);
+  obj = slab_obj (s, s->free[--s->free_cnt]);
+  if (s->free_cnt == 0)
+    list_remove (&s->elem);
+  c->in_use_cnt++;
+  c->alloc_cnt++;
+  lock_release (&c->lock);
+  return obj;
+}
+
+/* Gives OBJ, which must have been obtained from cache C with
+   kmem_cache_alloc(), back to C.  A null OBJ is ignored. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj)
+{
+  struct slab *s;
+  size_t ofs;
+
+  if (obj == NULL)
+    return;
+
+  s = pg_round_down (obj);
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT (s->cache == c);
+  ofs = pg_ofs (obj) - c->obj_ofs;
+  ASSERT (ofs % c->obj_size == 0 && ofs / c->obj_size < c->objs_per_slab);
+
+#ifndef NDEBUG
+  /* Clear the object to help detect use-after-free bugs, unless
+     it has to stay constructed. */
+  if (c->ctor == NULL)
+    memset (obj, 0xcc, c->obj_size);
+#endif
+
+  lock_acquire (&c->lock);
+  ASSERT (s->free_cnt < c->objs_per_slab);
+  s->free[s->free_cnt++] = ofs / c->obj_size;
+  if (s->free_cnt == 1)
+    list_push_front (&c->slabs, &s->elem);
+  c->in_use_cnt--;
+
+  /* Give an empty slab back to the page allocator, unless it is
+     the only one left with free objects, so that a cache that is
+     used a little at a time does not keep getting and freeing the
+     same page. */
+  if (s->free_cnt == c->objs_per_slab
+      && list_begin (&c->slabs) != list_rbegin (&c->slabs))
+    {
+      list_remove (&s->elem);
+      c->slab_cnt--;
+      palloc_free_page (s);
+    }
+  lock_release (&c->lock);
+}
+
+/* Prints statistics for each object cache. */
+void
+malloc_print_stats (void)
+{
+  size_t i;
+
+  for (i = 0; i < cache_cnt; i++)
+    {
+      struct kmem_cache *c = &caches[i];
+      printf ("Slab %s: %zu-byte objects, %zu slabs, %zu in use, "
+              "%lld allocated\n", c->name, c->obj_size, c->slab_cnt,
+              c->in_use_cnt, c->alloc_cnt);
+    }
+}
@@ -10,4 +10,10 @@ void *calloc (size_t, size_t) __attribute__ ((malloc));
 void *realloc (void *, size_t);
 void free (void *);
 
+struct kmem_cache *kmem_cache_create (const char *name, size_t size,
+                                      void (*ctor) (void *));
+void *kmem_cache_alloc (struct kmem_cache *) __attribute__ ((malloc));
+void kmem_cache_free (struct kmem_cache *, void *);
+void malloc_print_stats (void);
+
 #endif /* threads/malloc.h */
@@ -2,6 +2,7 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -17,6 +18,8 @@
 #include "devices/swap.h"
 #include "vm/sharing.h"
 #include "vm/spt.h"
+#include "vm/mmap.h"
+#include "vm/cleaner.h"
 #include "userprog/pagedir.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -31,14 +34,51 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool is a buddy allocator.  Its free pages form blocks of
+   2**K pages aligned to their size, kept on one free list per
+   order K, with the list element in the block's first page.  A
+   request for N pages splits the smallest block of at least N
+   pages and gives back the pages past N, and a freed block is
+   merged with its buddy for as long as the buddy is free too, so
+   both take O(log n) time.  The used map still records every
+   allocated page, for assertions.
+
+   A pool is guarded by disabling interrupts, not by a lock, as
+   thread_schedule_tail() frees a dead thread's page with
+   interrupts off and so must not wait.  Compile with
+   -DPALLOC_DEBUG to check a pool's consistency after every
+   change to it. */
+
+/* Number of block orders, enough for a 2 GB pool. */
+#define ORDER_CNT 20
+
+/* order_map value of a page that does not start a free block. */
+#define NOT_FREE 0xff
+
+/* Most pre-zeroed pages kept per pool.
+
+   The idle thread zeroes free pages ahead of time, see
+   palloc_zero_idle(), so that single page PAL_ZERO requests
+   rarely have to memset on the requesting thread's time.  Such
+   pages are marked used in the pool's used map while they wait
+   in the pool's zeroed stack; they go to any request once the
+   pool has no other free page. */
+#define ZEROED_MAX 32
 
 /* A memory pool. */
 struct pool
   {
-    struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
     uint8_t *base;                      /* Base of pool. */
+    size_t page_cnt;                    /* Number of pages from BASE. */
+    struct list free_lists[ORDER_CNT];  /* Free blocks by order. */
+    uint8_t *order_map;                 /* Per page, order of the free
+                                           block it starts or NOT_FREE. */
+    void *zeroed[ZEROED_MAX];           /* Free pages already zeroed. */
+    size_t zeroed_cnt;                  /* Pages in ZEROED. */
+    size_t zeroed_max;                  /* Most pages kept in ZEROED. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -47,25 +87,28 @@ static struct pool kernel_pool, user_pool;
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static size_t buddy_alloc (struct pool *, size_t page_cnt);
+static void buddy_free (struct pool *, size_t page_idx, size_t page_cnt);
+static void *take_zeroed (struct pool *);
+static bool zero_ahead (struct pool *);
+#ifdef PALLOC_DEBUG
+static void check_pool (struct pool *);
+#else
+#define check_pool(POOL) ((void) 0)
+#endif
 
-/* stroing meta data about the memory frames */
-struct hash frame_table;
-
-/* queue iterator for SECOND-CHANCE EVICTION */
-struct list_elem *index;
-
-/* queue for SECOND-CHANCE EVICTION ALGORITHM */
-struct list queue;
+/* PAL_ZERO page requests served from and not from the zeroed
+   stacks. */
+static long long zeroed_hit_cnt, zeroed_miss_cnt;
 
 /* stroing sharing data for files */
 struct hash share_table;
 
-/* synchronising frame table accesses */
-struct lock frame_lock;
-
 /* synchronising share table accesses */
 struct lock share_lock;
 
+static void *evict_page (void);
+
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
 void
@@ -87,23 +130,15 @@ palloc_init (size_t user_page_limit)
              user_pages, "user pool");
 
   /* Initialise the frame table */
-  if (!generate_frame_table(&frame_table))
-  {
-    PANIC("Could not generate frame table! \n");
-  }
-
-  list_init(&queue);
-  index = list_begin(&queue);
+  frame_init(user_pool.base, bitmap_size(user_pool.used_map));
 
-  /* Initialise the frame table */
+  /* Initialise the sharing table */
   if (!generate_sharing_table(&share_table))
   {
     PANIC("Could not generate sharing table! \n");
   }
 
-  /* Initialise the swap space */
   lock_init(&share_lock);
-  lock_init(&frame_lock);
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
@@ -116,15 +151,16 @@ void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  enum intr_level old_level;
   void *pages;
   size_t page_idx;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
+  old_level = intr_disable ();
+  page_idx = buddy_alloc (pool, page_cnt);
+  intr_set_level (old_level);
 
   if (page_idx != BITMAP_ERROR)
     pages = pool->base + PGSIZE * page_idx;
@@ -149,126 +185,196 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
    address.
    If PAL_USER is set, the page is obtained from the user pool,
    otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
-   then the page is filled with zeros.  If no pages are
-   available, returns a null pointer, unless PAL_ASSERT is set in
-   FLAGS, in which case the kernel panics. */
+   then the page is filled with zeros, preferably by taking one
+   the idle thread zeroed earlier.  A full user pool is
+   made room in by evicting a frame, unless PAL_NOEVICT is set.
+   If no pages are available, returns a null pointer, unless
+   PAL_ASSERT is set in FLAGS, in which case the kernel panics. */
 void *
 palloc_get_page (enum palloc_flags flags) 
 {
-  void *kpage =  palloc_get_multiple (flags, 1);
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  void *kpage = NULL;
+
+  if (flags & PAL_ZERO)
+    {
+      kpage = take_zeroed (pool);
+      if (kpage != NULL)
+        zeroed_hit_cnt++;
+      else
+        zeroed_miss_cnt++;
+    }
+  if (kpage == NULL)
+    kpage = palloc_get_multiple (flags & ~PAL_ASSERT, 1);
+  if (kpage == NULL)
+    kpage = take_zeroed (pool);
 
   if (flags & PAL_USER)
   {
-    bool prev_frame = re_lock_acquire(&frame_lock);
-    if (kpage == NULL)
+    if (kpage == NULL && !(flags & PAL_NOEVICT))
     { 
-      /* disable interrupts, select frame for eviction and page_dir_clear */
-      enum intr_level old_level = intr_disable();
-      struct frame_entry *fe = evict_frame(&queue, &index);
-      struct list_elem *e;
-      for (e = list_begin(&fe->owners); 
-           e != list_end (&fe->owners);
-           e = list_next(e))
+      kpage = evict_page();
+      if (kpage != NULL && (flags & PAL_ZERO))
       {
-        struct owner *o = list_entry(e, struct owner, elem);
-        pagedir_clear_page(o->t->pagedir, o->upage);
+        memset(kpage, 0, PGSIZE); 
       }
-      intr_set_level(old_level);
+    }
+    else if (kpage != NULL)
+    {
+      insert_frame(kpage);
+    }
+  }
 
+  if (kpage == NULL && (flags & PAL_ASSERT))
+  {
+    PANIC ("PAL_ASSERT failed during page palloc! \n");  
+  }
+  return kpage;
+}
 
-      if (!fe)                                                  
-      {
-        re_lock_release(&frame_lock, prev_frame);
-        if (flags & PAL_ASSERT)
-        {
-          PANIC ("PAL_ASSERT failed during page palloc! \n");  
-        }
-        return NULL;
-      }
+/* Pops a page off POOL's zeroed stack, or returns a null pointer
+   if it is empty. */
+static void *
+take_zeroed (struct pool *pool)
+{
+  enum intr_level old_level;
+  void *page = NULL;
+
+  old_level = intr_disable ();
+  if (pool->zeroed_cnt > 0)
+    page = pool->zeroed[--pool->zeroed_cnt];
+  intr_set_level (old_level);
+  return page;
+}
 
-      /* Signal for swapping/free, remove */
-      ASSERT(fe->owners_list_size > 0);
-      e = list_begin(&fe->owners);
-      struct owner *frame_owner = list_entry(e, struct owner, elem);
-      bool prev_spt = re_lock_acquire(&frame_owner->t->spt_lock);
-      struct spt_entry *spe 
-          = find_spe(&frame_owner->t->sp_table, frame_owner->upage);
+/* Called by the idle thread with interrupts on.  Zeroes one free
+   page for a pool whose zeroed stack is short and returns true,
+   or returns false if there is nothing to do. */
+bool
+palloc_zero_idle (void)
+{
+  return zero_ahead (&kernel_pool) || zero_ahead (&user_pool);
+}
 
-      /* Page can be swapped if dirty */
-      if (pagedir_is_writable(frame_owner->t->pagedir, frame_owner->upage))
-      {
-        /* Checking for sharability */
-        if (pagedir_is_dirty(frame_owner->t->pagedir, frame_owner->upage))
-        {
-          /* Page swapping */ 
-          spe->location_prev = spe->location;
-          spe->location = SWAP_SLOT;
-          spe->swap_slot = swap_out(fe->kva);
-        }
+/* Zeroes a free page of POOL and pushes it on its zeroed stack,
+   if the stack is short.  Only the idle thread pushes, so the
+   stack still has room once the page is zeroed. */
+static bool
+zero_ahead (struct pool *pool)
+{
+  enum intr_level old_level;
+  size_t page_idx = BITMAP_ERROR;
+  void *page;
+
+  old_level = intr_disable ();
+  if (pool->zeroed_cnt < pool->zeroed_max)
+    page_idx = buddy_alloc (pool, 1);
+  intr_set_level (old_level);
+  if (page_idx == BITMAP_ERROR)
+    return false;
+
+  page = pool->base + PGSIZE * page_idx;
+  memset (page, 0, PGSIZE);
+
+  old_level = intr_disable ();
+  pool->zeroed[pool->zeroed_cnt++] = page;
+  intr_set_level (old_level);
+  return true;
+}
 
-        /* Reset frame_entry for new page */
-        if (flags & PAL_ZERO)
-        {
-          memset(fe->kva, 0,PGSIZE); 
-        }
+/* Returns the number of PAL_ZERO page requests served with a
+   pre-zeroed page in *HITS and of those zeroed on the spot in
+   *MISSES. */
+void
+palloc_zeroed_stats (long long *hits, long long *misses)
+{
+  *hits = zeroed_hit_cnt;
+  *misses = zeroed_miss_cnt;
+}
+
+/* Evicts a user frame and returns it, still pinned, for reuse.
+   Writable pages that were modified are saved first: to swap
+   when they are described by the owner's supplemental page
+   table, and back to their file when they are memory mapped.
+   Returns a null pointer if there is no user frame to evict. */
+static void *
+evict_page (void)
+{
+  struct frame_entry *fe = evict_frame();
+  if (fe == NULL)
+  {
+    return NULL;
+  }
 
-        ASSERT(fe->owners_list_size == 1);
+  /* No process may start sharing the frame from now on */
+  lock_acquire(&share_lock);
+  if (fe->share_entry)
+  {
+    delete_sharing_frame(&share_table, fe->share_entry);
+    fe->share_entry = NULL;
+  }
+  lock_release(&share_lock);
 
-        re_lock_release(&frame_owner->t->spt_lock, prev_spt);
-        list_remove(&frame_owner->elem);
-        free(frame_owner);
-        fe->owners_list_size = 0;
-        re_lock_release(&frame_lock, prev_frame);
+  /* Owners' spt_locks are held, see evict_frame() */
+  struct owner *o;
+  for (o = frame_first_owner(fe); o; o = frame_next_owner(fe, o))
+  {
+    uint32_t *pd = o->t->pagedir;
+    if (pd == NULL)
+    {
+      continue;
+    }
 
-        if (!fe->kva && (flags & PAL_ASSERT))
+    /* Unmap before checking the dirty bit, so that the owner
+       cannot modify the page after it has been saved.  A page
+       shared copy-on-write is mapped read-only but may be dirty,
+       so writability is the spt_entry's */
+    pagedir_clear_page(pd, o->upage);
+    struct spt_entry *spe = find_spe(&o->t->sp_table, o->upage);
+    bool dirty = pagedir_is_dirty(pd, o->upage)
+        && (spe ? spe->writable : pagedir_is_writable(pd, o->upage));
+    if (spe)
+    {
+      /* Page swapping, unless the cleaner already saved it */ 
+      size_t slot = spe->clean_slot;
+      if (dirty)
+      {
+        if (slot != NO_SWAP_SLOT)
         {
-          PANIC ("PAL_ASSERT failed during page palloc! \n");  
+          swap_drop(slot);
         }
-        return fe->kva;
-      }
-      
-      /* In the case of sharing - multiple owners or ALL_ZERO pages */ 
-      ASSERT(spe->location == FILE_SYS || spe->location == ALL_ZERO)
-      re_lock_release(&frame_owner->t->spt_lock, prev_spt);
-
-      struct list_elem *temp;      
-      for (; e != list_end (&fe->owners);)
-      {
-        temp = e;
-        e = list_next(e);
-        struct owner *o = list_entry(temp, struct owner, elem);
-
-        /* Reset frame_entry for new page */
-        if (flags & PAL_ZERO)
+        slot = swap_out(fe->kva);
+        if (slot == NO_SWAP_SLOT)
         {
-          memset(fe->kva, 0, PGSIZE); 
+          PANIC ("swap space exhausted");
         }
-
-        list_remove(temp);
-        free(o);
       }
-      
-      /* Reset frame_entry for new page and remove sharing entry */
-      fe->owners_list_size = 0;
-      bool prev_share = re_lock_acquire(&share_lock);
-      delete_sharing_frame(&share_table, fe->inner_entry);
-      re_lock_release(&share_lock, prev_share);
-      fe->inner_entry = NULL;
-      fe->owners_list_size = 0;
-      re_lock_release(&frame_lock, prev_frame);
-      return fe->kva;
-    } 
-
-    /* Insert new entry into page table */
-    struct frame_entry *frame_pt  = malloc(sizeof(struct frame_entry));
-    list_init (&frame_pt->owners);
-    frame_pt->kva = kpage;
-    frame_pt->owners_list_size = 0;
-    frame_pt->inner_entry = NULL;
-    insert_frame(&frame_table, &queue, frame_pt);
-    re_lock_release(&frame_lock, prev_frame);
+      if (slot != NO_SWAP_SLOT)
+      {
+        spe->clean_slot = NO_SWAP_SLOT;
+        spe->location_prev = spe->location;
+        spe->location = SWAP_SLOT;
+        spe->swap_slot = slot;
+      }
+    }
+    else if (dirty)
+    {
+      struct page_mmap_entry *pentry 
+          = get_mmap_page(&o->t->page_mmap_table, o->upage);
+      ASSERT(pentry);
+      mmap_write_back(pentry, fe->kva);
+    }
+    pagedir_set_dirty(pd, o->upage, false);
   }
-  return kpage;
+  unlock_owners(fe);
+
+  struct frame_entry *kframe_entry = find_frame_entry(fe->kva);
+  ASSERT(kframe_entry == fe);
+  frame_clear_owners(fe);
+  frame_release(fe);
+
+  cleaner_evicted();
+  return fe->kva;
 }
 
 /* Frees the PAGE_CNT pages starting at PAGES. */
@@ -276,6 +382,7 @@ void
 palloc_free_multiple (void *pages, size_t page_cnt) 
 {
   struct pool *pool;
+  enum intr_level old_level;
   size_t page_idx;
 
   ASSERT (pg_ofs (pages) == 0);
@@ -294,8 +401,12 @@ palloc_free_multiple (void *pages, size_t page_cnt)
 #ifndef NDEBUG
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
+  old_level = intr_disable ();
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  buddy_free (pool, page_idx, page_cnt);
+  check_pool (pool);
+  intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
@@ -304,55 +415,34 @@ palloc_free_page (void *page)
 {
   if (page_from_pool (&user_pool, page))
   {
-    bool prev_frame = re_lock_acquire(&frame_lock);
-    bool prev_share = re_lock_acquire(&share_lock);
+    lock_acquire(&share_lock);
 
     struct thread *t = thread_current();
-    struct owner *owner_obj = NULL;
-    struct frame_entry *kframe_entry = find_frame_entry(&frame_table, page);
+    struct frame_entry *kframe_entry = find_frame_entry(page);
     ASSERT(kframe_entry);
 
-    struct list_elem *e;
-    for (e = list_begin(&kframe_entry->owners); 
-         e != list_end(&kframe_entry->owners);
-         e = list_next(e))
-    {    
-        owner_obj = list_entry(e, struct owner, elem);
-        if (owner_obj->t->tid == t->tid)
-        {
-          break;
-        }
-    }
-
-    if (owner_obj)
+    void *upage = frame_remove_owner(kframe_entry, t);
+    if (upage && t->pagedir)
     {
-      list_remove(&owner_obj->elem);
-      kframe_entry->owners_list_size--;
+      pagedir_clear_page(t->pagedir, upage);
     }
     
-    if (kframe_entry->owners_list_size == 0) 
+    /* A frame still published in the sharing table holds a page
+       of a file as it is on disk.  It is kept when its last owner
+       lets go, so that the next process to map the page finds it
+       in memory, until the evictor wants the frame back. */
+    if (kframe_entry->owners_list_size > 0 || kframe_entry->share_entry)
     { 
-      if (kframe_entry->inner_entry) 
-      {
-        ASSERT(delete_sharing_frame(&share_table, kframe_entry->inner_entry));
-        free(owner_obj);
-      }
-      
-      ASSERT(free_frame(&frame_table, &queue, page, &index));
-      re_lock_release(&share_lock, prev_share);
-      re_lock_release(&frame_lock, prev_frame);
-    } else 
-    {
-      if (t->pagedir)
-      {
-        pagedir_clear_page(t->pagedir, owner_obj->upage);
-      }
-      free(owner_obj);
-
-      re_lock_release(&share_lock, prev_share);
-      re_lock_release(&frame_lock, prev_frame);
+      frame_release(kframe_entry);
+      lock_release(&share_lock);
       return;
     }
+
+    /* Keep the evictor away until the frame has left the table */
+    kframe_entry->pinned = true;
+    frame_release(kframe_entry);
+    lock_release(&share_lock);
+    free_frame(page);
   }
   palloc_free_multiple (page, 1);
 }
@@ -362,22 +452,175 @@ palloc_free_page (void *page)
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
+  /* We'll put the pool's used_map and order_map at its base.
+     Calculate the space needed for them and subtract it from
+     the pool's size.  The maps are sized for the whole range,
+     slightly more than the pages left. */
+  size_t bm_size = bitmap_buf_size (page_cnt);
+  size_t bm_pages = DIV_ROUND_UP (bm_size + page_cnt, PGSIZE);
+  size_t order;
   if (bm_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
   page_cnt -= bm_pages;
 
   printf ("%zu pages available in %s.\n", page_cnt, name);
 
-  /* Initialize the pool. */
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
+  /* Initialize the pool, with all of its pages free. */
+  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_size);
+  p->order_map = (uint8_t *) base + bm_size;
+  memset (p->order_map, NOT_FREE, page_cnt);
   p->base = base + bm_pages * PGSIZE;
+  p->page_cnt = page_cnt;
+  for (order = 0; order < ORDER_CNT; order++)
+    list_init (&p->free_lists[order]);
+  buddy_free (p, 0, page_cnt);
+  check_pool (p);
+
+  p->zeroed_cnt = 0;
+  p->zeroed_max = page_cnt / 16 < ZEROED_MAX ? page_cnt / 16 : ZEROED_MAX;
+}
+
+/* Returns the free list element kept in page PAGE_IDX of P. */
+static struct list_elem *
+page_elem (const struct pool *p, size_t page_idx)
+{
+  return (struct list_elem *) (p->base + PGSIZE * page_idx);
+}
+
+/* Returns the index of the page holding free list element E. */
+static size_t
+elem_page (const struct pool *p, struct list_elem *e)
+{
+  return ((uint8_t *) e - p->base) / PGSIZE;
 }
 
+/* Puts the block of 2**ORDER pages at PAGE_IDX on P's free
+   lists. */
+static void
+push_block (struct pool *p, size_t page_idx, size_t order)
+{
+  p->order_map[page_idx] = order;
+  list_push_front (&p->free_lists[order], page_elem (p, page_idx));
+}
+
+/* Takes the free block of 2**ORDER pages at PAGE_IDX off P's free
+   lists. */
+static void
+remove_block (struct pool *p, size_t page_idx)
+{
+  p->order_map[page_idx] = NOT_FREE;
+  list_remove (page_elem (p, page_idx));
+}
+
+/* Allocates PAGE_CNT contiguous pages from P, which must be
+   guarded by the caller, and returns the index of the first, or
+   BITMAP_ERROR if no free block is big enough. */
+static size_t
+buddy_alloc (struct pool *p, size_t page_cnt)
+{
+  size_t want, order, page_idx;
+
+  for (want = 0; ((size_t) 1 << want) < page_cnt; want++)
+    if (want + 1 >= ORDER_CNT)
+      return BITMAP_ERROR;
+  for (order = want; order < ORDER_CNT; order++)
+    if (!list_empty (&p->free_lists[order]))
+      break;
+  if (order >= ORDER_CNT)
+    return BITMAP_ERROR;
+
+  page_idx = elem_page (p, list_front (&p->free_lists[order]));
+  remove_block (p, page_idx);
+
+  /* Split off upper halves until the block is just big enough,
+     then give back the pages past PAGE_CNT. */
+  while (order > want)
+    {
+      order--;
+      push_block (p, page_idx + ((size_t) 1 << order), order);
+    }
+  buddy_free (p, page_idx + page_cnt, ((size_t) 1 << want) - page_cnt);
+
+  ASSERT (bitmap_none (p->used_map, page_idx, page_cnt));
+  bitmap_set_multiple (p->used_map, page_idx, page_cnt, true);
+  check_pool (p);
+  return page_idx;
+}
+
+/* Returns the PAGE_CNT pages of P starting at PAGE_IDX to the free
+   lists, which must be guarded by the caller.  The range is cut
+   into the largest blocks aligned to their size, and each block
+   is merged with its buddy while the buddy is free as a whole. */
+static void
+buddy_free (struct pool *p, size_t page_idx, size_t page_cnt)
+{
+  while (page_cnt > 0)
+    {
+      size_t order = 0, block_idx;
+
+      while (order + 1 < ORDER_CNT
+             && page_idx % ((size_t) 2 << order) == 0
+             && ((size_t) 2 << order) <= page_cnt)
+        order++;
+      block_idx = page_idx;
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+
+      for (; order + 1 < ORDER_CNT; order++)
+        {
+          size_t buddy = block_idx ^ ((size_t) 1 << order);
+          if (buddy + ((size_t) 1 << order) > p->page_cnt
+              || p->order_map[buddy] != order)
+            break;
+          remove_block (p, buddy);
+          block_idx &= ~((size_t) 1 << order);
+        }
+      push_block (p, block_idx, order);
+    }
+}
+
+#ifdef PALLOC_DEBUG
+/* Panics unless P is consistent: each free block lies in the
+   pool, is aligned to its size, is marked free in the used map
+   and has no free buddy of its own order, and the free blocks
+   and used pages add up to the whole pool without overlap. */
+static void
+check_pool (struct pool *p)
+{
+  size_t free_cnt = 0, block_cnt = 0;
+  size_t order, i;
+
+  for (order = 0; order < ORDER_CNT; order++)
+    {
+      size_t size = (size_t) 1 << order;
+      struct list_elem *e;
+
+      for (e = list_begin (&p->free_lists[order]);
+           e != list_end (&p->free_lists[order]); e = list_next (e))
+        {
+          size_t page_idx = elem_page (p, e);
+          size_t buddy = page_idx ^ size;
+
+          ASSERT (page_idx % size == 0);
+          ASSERT (page_idx + size <= p->page_cnt);
+          ASSERT (p->order_map[page_idx] == order);
+          ASSERT (bitmap_none (p->used_map, page_idx, size));
+          ASSERT (buddy + size > p->page_cnt
+                  || p->order_map[buddy] != order);
+          free_cnt += size;
+          block_cnt++;
+        }
+    }
+
+  for (i = 0; i < p->page_cnt; i++)
+    if (p->order_map[i] != NOT_FREE)
+      block_cnt--;
+  ASSERT (block_cnt == 0);
+  ASSERT (free_cnt + bitmap_count (p->used_map, 0, p->page_cnt, true)
+          == p->page_cnt);
+}
+#endif
+
 /* Returns true if PAGE was allocated from POOL,
    false otherwise. */
 static bool
@@ -392,6 +635,6 @@ page_from_pool (const struct pool *pool, void *page)
 
 void palloc_finish (void)
 {
-  destroy_frame_table(&frame_table);
+  destroy_frame_table();
   destroy_share_table(&share_table);
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 /* How to allocate pages. */
@@ -8,21 +9,20 @@ enum palloc_flags
   {
     PAL_ASSERT = 001,           /* Panic on failure. */
     PAL_ZERO = 002,             /* Zero page contents. */
-    PAL_USER = 004              /* User page. */
+    PAL_USER = 004,             /* User page. */
+    PAL_NOEVICT = 010           /* Fail rather than evict a user page. */
   };
 
-extern struct hash frame_table;
 extern struct hash share_table;
 extern struct lock share_lock;
-extern struct lock frame_lock;
-extern struct list_elem *index;
-extern struct list queue;
 
 void palloc_init (size_t user_page_limit);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+bool palloc_zero_idle (void);
+void palloc_zeroed_stats (long long *hits, long long *misses);
 void palloc_finish (void);
 
 #endif /* threads/palloc.h */
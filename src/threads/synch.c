@@ -442,6 +442,78 @@ cond_broadcast (struct condition *cond, struct lock *lock)
     cond_signal (cond, lock);
 }
 
+/* Initializes RW as unheld. */
+void
+rw_lock_init (struct rw_lock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_init (&rw->lock);
+  cond_init (&rw->can_read);
+  cond_init (&rw->can_write);
+  rw->readers = 0;
+  rw->writers_waiting = 0;
+  rw->writing = false;
+}
+
+/* Acquires RW for reading, sleeping while a writer holds it or
+   waits for it.  May sleep, so must not be called from an
+   interrupt handler. */
+void
+rw_lock_acquire_read (struct rw_lock *rw)
+{
+  ASSERT (!intr_context ());
+
+  lock_acquire (&rw->lock);
+  while (rw->writing || rw->writers_waiting > 0)
+    cond_wait (&rw->can_read, &rw->lock);
+  rw->readers++;
+  lock_release (&rw->lock);
+}
+
+/* Releases RW, held for reading by the current thread. */
+void
+rw_lock_release_read (struct rw_lock *rw)
+{
+  lock_acquire (&rw->lock);
+  ASSERT (rw->readers > 0);
+  if (--rw->readers == 0)
+    cond_signal (&rw->can_write, &rw->lock);
+  lock_release (&rw->lock);
+}
+
+/* Acquires RW for writing, sleeping until no reader or writer
+   holds it.  May sleep, so must not be called from an interrupt
+   handler. */
+void
+rw_lock_acquire_write (struct rw_lock *rw)
+{
+  ASSERT (!intr_context ());
+
+  lock_acquire (&rw->lock);
+  rw->writers_waiting++;
+  while (rw->writing || rw->readers > 0)
+    cond_wait (&rw->can_write, &rw->lock);
+  rw->writers_waiting--;
+  rw->writing = true;
+  lock_release (&rw->lock);
+}
+
+/* Releases RW, held for writing by the current thread.  Waiting
+   writers go first; readers are let in once there are none. */
+void
+rw_lock_release_write (struct rw_lock *rw)
+{
+  lock_acquire (&rw->lock);
+  ASSERT (rw->writing);
+  rw->writing = false;
+  if (rw->writers_waiting > 0)
+    cond_signal (&rw->can_write, &rw->lock);
+  else
+    cond_broadcast (&rw->can_read, &rw->lock);
+  lock_release (&rw->lock);
+}
+
 static bool cond_pri_comparator (const struct list_elem *a, 
   const struct list_elem *b, void *aux UNUSED) {
     return list_entry(a, struct semaphore_elem, elem) -> highest_priority
@@ -46,6 +46,25 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Readers-writer lock: held by any number of readers or by a
+   single writer.  A waiting writer keeps new readers out, so a
+   steady stream of readers cannot starve it. */
+struct rw_lock
+  {
+    struct lock lock;           /* Guards the fields below. */
+    struct condition can_read;  /* Signalled when readers may enter. */
+    struct condition can_write; /* Signalled when a writer may enter. */
+    unsigned readers;           /* Number of readers holding it. */
+    unsigned writers_waiting;   /* Number of writers waiting for it. */
+    bool writing;               /* True while a writer holds it. */
+  };
+
+void rw_lock_init (struct rw_lock *);
+void rw_lock_acquire_read (struct rw_lock *);
+void rw_lock_release_read (struct rw_lock *);
+void rw_lock_acquire_write (struct rw_lock *);
+void rw_lock_release_write (struct rw_lock *);
+
 /* comparator for int_elems to maintain maximal queue */
 bool donor_comparator (const struct list_elem *a, 
   const struct list_elem *b, void *aux);
@@ -2,6 +2,7 @@
 #include <debug.h>
 #include <stddef.h>
 #include <random.h>
+#include <round.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/flags.h"
@@ -23,9 +24,18 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Number of distinct priority levels. */
+#define PRI_CNT (PRI_MAX - PRI_MIN + 1)
+
+/* Run queue of processes in THREAD_READY state, that is, processes
+   that are ready to run but not actually running.  There is one
+   FIFO list per priority level.  Bit (PRI_MAX - p) of ready_bitmap
+   is set iff ready_queues[p] is non-empty, so the highest
+   non-empty level is found with a single `bsf' on the first
+   non-zero word. */
+static struct list ready_queues[PRI_CNT];
+static uint32_t ready_bitmap[DIV_ROUND_UP (PRI_CNT, 32)];
+static size_t ready_cnt;        /* # of threads in ready_queues. */
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -73,6 +83,9 @@ static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
+static void ready_push (struct thread *);
+static void ready_remove (struct thread *);
+static int ready_max_priority (void);
 
 static int32_t load_avg; /* load_avg of system */
 
@@ -93,10 +106,13 @@ static int32_t load_avg; /* load_avg of system */
 void
 thread_init (void) 
 {
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (i = 0; i < PRI_CNT; i++)
+    list_init (&ready_queues[i]);
   list_init (&all_list);
 
   /* Set up a thread structure for the running thread. */
@@ -131,7 +147,7 @@ thread_start (void)
 size_t
 threads_ready (void)
 {
-  return list_size (&ready_list);      
+  return ready_cnt;
 }
 
 /* Called by the timer interrupt handler at each timer tick.
@@ -193,8 +209,15 @@ thread_tick (void) {
 void
 thread_print_stats (void) 
 {
+  long long hits, misses, total;
+
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
+
+  palloc_zeroed_stats (&hits, &misses);
+  total = hits + misses;
+  printf ("Idle: %lld of %lld zeroed page requests pre-zeroed (%lld%%)\n",
+          hits, total, total > 0 ? hits * 100 / total : 0);
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -313,7 +336,7 @@ thread_unblock (struct thread *t)
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
 
-  list_push_back(&ready_list, &t->elem);
+  ready_push (t);
 
   t->status = THREAD_READY;
 
@@ -415,7 +438,6 @@ thread_exit (void)
   intr_set_level(old_level);
     
   /* Free fd objects held by the current thread */
-  lock_acquire(&file_lock);
   ls = &t->fds;
   for (e = list_begin(ls);
        e != list_end(ls);)
@@ -424,14 +446,13 @@ thread_exit (void)
     e = list_next(e);
     struct fd_st *fd_obj = list_entry(temp, struct fd_st, elem);
     file_close(fd_obj->file_pt);
-    free(fd_obj);
+    kmem_cache_free(fd_cache, fd_obj);
   }
 
   if (t->exec_file) {
     file_allow_write(t->exec_file);
     file_close(t->exec_file);
   }
-  lock_release(&file_lock);
   printf ("%s: exit(%d)\n", t->name, t->exit_status);
 
   t->status = THREAD_DYING;
@@ -453,8 +474,8 @@ thread_yield (void)
   old_level = intr_disable ();
   if (cur != idle_thread) 
   {
-    /* Adding to ready list in priority queue fashion (maximal) */
-    list_push_back(&ready_list, &(cur->elem));
+    /* Adding to the back of the run queue for its priority */
+    ready_push (cur);
   } 
   
   cur->status = THREAD_READY;
@@ -530,8 +551,7 @@ thread_set_priority (int new_priority)
     thread_current ()->priority = new_priority;
   }
 
-  if ((list_entry(list_max(&ready_list, pri_comparator, NULL), 
-      struct thread, elem)) -> priority > thread_get_priority()) 
+  if (ready_max_priority () > thread_get_priority ()) 
   {
     thread_yield();
   }
@@ -563,7 +583,7 @@ thread_priority_calc (struct thread *t, void *aux UNUSED)
   else if (pri < PRI_MIN)
     pri = PRI_MIN;
   
-  t->priority = pri;
+  re_arrange (t, pri);
 }
 
 /* Recalculates the priotity of all the threads*/
@@ -571,9 +591,6 @@ void
 thread_priority_calc_all (void) {
 
   thread_foreach(thread_priority_calc, NULL);
-  
-  if (list_empty (&ready_list))
-    return;
 }
 
 /* Sets the current thread's nice value to NICE. */
@@ -584,9 +601,7 @@ thread_set_nice (int new_nice)
   thread_recent_cpu_calc (thread_current(), NULL);
   thread_priority_calc (thread_current(), NULL);
 
-  if (thread_get_priority() < (list_entry(list_max
-  (&ready_list, pri_comparator, NULL), 
-  struct thread, elem) -> priority)) 
+  if (thread_get_priority () < ready_max_priority ()) 
     thread_yield();
 }
 
@@ -670,6 +685,17 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
+      /* Nothing else wants the CPU, so zero free pages ahead for
+         PAL_ZERO requests.  A page at a time with interrupts on,
+         stopping as soon as an interrupt has made a thread
+         ready. */
+      intr_enable ();
+      while (threads_ready () == 0 && palloc_zero_idle ())
+        continue;
+      intr_disable ();
+      if (threads_ready () > 0)
+        continue;
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -790,14 +816,14 @@ alloc_frame (struct thread *t, size_t size)
 static struct thread *
 next_thread_to_run (void) 
 {
-  if (list_empty (&ready_list)) 
+  if (ready_cnt == 0) 
   {
     return idle_thread;
   }
   else {
-    struct list_elem *max_elem = list_max (&ready_list, pri_comparator, NULL);
-    struct thread *t = list_entry (max_elem, struct thread, elem);
-    list_remove(max_elem);
+    struct list *q = &ready_queues[ready_max_priority ()];
+    struct thread *t = list_entry (list_front (q), struct thread, elem);
+    ready_remove (t);
     return t;
   }
 }
@@ -890,7 +916,75 @@ allocate_tid (void)
    Used by switch.S, which can't figure it out on its own. */
 uint32_t thread_stack_ofs = offsetof (struct thread, stack);
 
-/* Comparator for ready_list (ordered) */
+/* Appends ready thread T to the run queue for its priority.
+   Must be called with interrupts off. */
+static void
+ready_push (struct thread *t)
+{
+  int level = PRI_MAX - t->priority;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  list_push_back (&ready_queues[t->priority], &t->elem);
+  ready_bitmap[level / 32] |= 1u << (level % 32);
+  ready_cnt++;
+}
+
+/* Removes ready thread T from the run queue for its priority.
+   Must be called with interrupts off. */
+static void
+ready_remove (struct thread *t)
+{
+  int level = PRI_MAX - t->priority;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (ready_cnt > 0);
+
+  list_remove (&t->elem);
+  if (list_empty (&ready_queues[t->priority]))
+    ready_bitmap[level / 32] &= ~(1u << (level % 32));
+  ready_cnt--;
+}
+
+/* Returns the highest priority of any ready thread, or
+   PRI_MIN - 1 if the run queue is empty. */
+static int
+ready_max_priority (void)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof ready_bitmap / sizeof *ready_bitmap; i++)
+    if (ready_bitmap[i] != 0)
+      {
+        uint32_t level;
+        asm ("bsfl %1, %0" : "=r" (level) : "rm" (ready_bitmap[i]));
+        return PRI_MAX - (int) (i * 32 + level);
+      }
+  return PRI_MIN - 1;
+}
+
+/* Sets T's effective priority to PRIORITY.  If T is ready, it is
+   moved to the back of the run queue for its new priority. */
+void
+re_arrange (struct thread *t, int priority)
+{
+  enum intr_level old_level;
+
+  ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
+
+  old_level = intr_disable ();
+  if (t->status == THREAD_READY && t->priority != priority)
+    {
+      ready_remove (t);
+      t->priority = priority;
+      ready_push (t);
+    }
+  else
+    t->priority = priority;
+  intr_set_level (old_level);
+}
+
+/* Comparator for ordered lists of threads (e.g. semaphore waiters) */
 bool 
 pri_comparator (const struct list_elem *a,
             const struct list_elem *b,
@@ -909,7 +1003,7 @@ void calculate_priority(struct thread *t)
   old_level = intr_disable();  // synchronisation issues
   if (list_empty(&t->donations)) 
   {
-    t->priority = t->base_priority;
+    re_arrange (t, t->base_priority);
     intr_set_level(old_level);
     return;
   } 
@@ -919,7 +1013,7 @@ void calculate_priority(struct thread *t)
 
   if (highest_donor->priority > t->base_priority) 
   {
-    t->priority = highest_donor->priority;
+    re_arrange (t, highest_donor->priority);
   }
 
   if (old_priority == t->priority) 
@@ -153,8 +153,10 @@ struct thread
     /* lock to synchronize acces to the spt table */
     struct lock spt_lock;
 
-    /* file name for loading executable file */
-    char file_name[MAX_FILE_NAME_SIZE];
+    /* swap readahead: the page a sequential swap-in would fault on
+       next, and how many slots to read ahead of each swap-in */
+    void *ra_next;
+    unsigned ra_window;
 #endif
 
     /* Pointer to User Stack Frame for User Stack Growth */
@@ -208,8 +210,8 @@ void thread_recent_cpu_calc_all (void);
 int thread_get_load_avg (void);
 void thread_load_avg_calc (void);
 
-/* re-arrange ready_list to account for priority change */
-void re_arrange(struct thread *t);
+/* sets effective priority, moving T within the run queue if ready */
+void re_arrange(struct thread *t, int priority);
 
 /* re-calculates the effective priority for a thread */
 void calculate_priority(struct thread *t);
@@ -18,11 +18,19 @@
 /* Number of page faults processed. */
 static long long page_fault_cnt;
 
+/* Size, in pages, of the aligned block of file pages fault_around()
+   maps along with a faulting one; a power of 2 */
+#define FAULT_AROUND_PAGES 8
+
 static void kill (struct intr_frame *);
 static void page_fault (struct intr_frame *);
-static bool actual_load_page(struct spt_entry *spe);
+static bool actual_load_page(struct spt_entry *spe, bool write, bool around);
 static bool 
-actual_load_mmap_page(struct page_mmap_entry *pentry);
+actual_load_mmap_page(struct page_mmap_entry *pentry, bool around);
+static void fault_around(struct thread *t, void *upage,
+                         struct file_mmap_entry *fentry);
+static size_t readahead_count(struct thread *t, struct spt_entry *spe);
+static bool copy_on_write(struct thread *t, void *upage);
 
 /* Registers handlers for interrupts that can be caused by user
    programs.
@@ -184,7 +192,6 @@ page_fault (struct intr_frame *f)
   /* check SPT if page was not present */
   if (not_present)
    {
-      lock_acquire(&frame_lock);
       lock_acquire(&t->spt_lock);
 
       struct hash spt = t->sp_table;
@@ -203,20 +210,24 @@ page_fault (struct intr_frame *f)
             /* User tried to write to a read only page */
             printf("user write to read only page\n");
             lock_release(&t->spt_lock);
-            lock_release(&frame_lock);
             goto failure;
          }
 
-         /* Code reaching here indicates that access was valid, load neccesary */ 
-         if (spe->location == FILE_SYS || spe->location == ALL_ZERO)
+         /* Code reaching here indicates that access was valid, load neccesary.
+            A stack page that was evicted clean never left the zero page. */ 
+         if (spe->location == FILE_SYS || spe->location == ALL_ZERO
+             || spe->location == STACK)
          {
-            if (!actual_load_page(spe))
+            if (!actual_load_page(spe, write, false))
             {  
                printf("Failed to load spt page entry at addr: %p\n", fault_addr);
                lock_release(&t->spt_lock);
-               lock_release(&frame_lock);
                goto failure;
             }
+            if (spe->location == FILE_SYS)
+            {
+               fault_around(t, fault_upage, NULL);
+            }
          } 
          else
          {
@@ -225,27 +236,22 @@ page_fault (struct intr_frame *f)
 
             // void *kpage = palloc_get_page(PAL_USER);
             spe->location = spe->location_prev;
-            void *kpage = get_and_install_page(
-                     PAL_USER,
-                     spe->upage,
-                     t->pagedir,
-                     spe->writable,
-                     spe->location==FILE_SYS && !spe->writable,
-                     t->file_name,
-                     (spe->absolute_off - (spe->absolute_off % PGSIZE)) / PGSIZE);
+            void *kpage = get_and_install_page(PAL_USER,
+                                               spe->upage,
+                                               t->pagedir,
+                                               spe->writable);
 
             if (!kpage)
             {
                printf ("Could not allocate page during swap in \n");
                lock_release(&t->spt_lock);
-               lock_release(&frame_lock);
                goto failure;
             }
-            swap_in (kpage, spe->swap_slot);
+            swap_in_ahead (kpage, spe->swap_slot, readahead_count(t, spe));
             pagedir_set_dirty(t->pagedir, spe->upage, true);
+            release_installed_page(kpage, NULL);
          }
          lock_release(&t->spt_lock);
-         lock_release(&frame_lock);
          return;
       }
 
@@ -255,12 +261,12 @@ page_fault (struct intr_frame *f)
          = get_mmap_page(&t->page_mmap_table, fault_upage);
       if (pentry)
       {
-         if (!actual_load_mmap_page(pentry))
+         if (!actual_load_mmap_page(pentry, false))
          {
             NOT_REACHED();
          }
+         fault_around(t, fault_upage, pentry->fentry);
          lock_release(&t->spt_lock);
-         lock_release(&frame_lock);
          return;
       }
 
@@ -276,40 +282,40 @@ page_fault (struct intr_frame *f)
            if ((unsigned) (PHYS_BASE - next_upage) > (unsigned) STACK_MAX_SIZE)
            {
                lock_release(&t->spt_lock);
-               lock_release(&frame_lock);
                delete_thread(-1);
            }
            uint8_t *k_new_page = get_and_install_page(PAL_USER | PAL_ZERO, 
                                 next_upage, 
                                 thread_current()->pagedir, 
-                                true,
-                                false,
-                                NULL,
-                                -1);
+                                true);
 
            if (!k_new_page)
            {
               printf("Cound not allocate new page for stack\n");
               lock_release(&t->spt_lock);
-              lock_release(&frame_lock);
               goto failure;
            }
 
 
           /* Making the SPT entry for this page */
-          struct spt_entry * spe = malloc(sizeof(struct spt_entry));
+          struct spt_entry * spe = kmem_cache_alloc(spe_cache);
           spe -> upage = next_upage;
           spe -> location = STACK;
           spe -> writable = true;
+          spe -> clean_slot = NO_SWAP_SLOT;
           
           ASSERT(!insert_spe(&thread_current()->sp_table, spe));
+          release_installed_page(k_new_page, NULL);
           lock_release(&t->spt_lock);
-          lock_release(&frame_lock);
           return;
         }
       }
       lock_release(&t->spt_lock);
-      lock_release(&frame_lock);
+   }
+   else if (write && is_user_vaddr(fault_addr)
+            && copy_on_write(t, pg_round_down(fault_addr)))
+   {
+      return;
    }
 
  failure:
@@ -331,68 +337,95 @@ page_fault (struct intr_frame *f)
    kill (f);
 }
 
-/* function called when page faults for FILE_SYS or ALL_ZERO pages */
+/* function called when page faults for FILE_SYS, ALL_ZERO or
+   STACK pages.  AROUND loads are fault-around guesses, which only
+   use a free frame.
+
+   Pages of the executable are shared between the processes
+   running it.  Writable ones are shared too, mapped read-only,
+   until the first write, see copy_on_write(); unless WRITE, as
+   the faulting access would copy the page straight away. */
 static bool 
-actual_load_page(struct spt_entry *spe)
+actual_load_page(struct spt_entry *spe, bool write, bool around)
 {  
    /* hygeine check */
-   ASSERT (spe->location == FILE_SYS ||  spe->location == ALL_ZERO);
+   ASSERT (spe->location == FILE_SYS 
+           || spe->location == ALL_ZERO 
+           || spe->location == STACK);
 
    struct thread *t = thread_current ();
    uint8_t *kpage;
    enum palloc_flags flags = PAL_USER;
-   if (spe->location == ALL_ZERO)
+   if (spe->location != FILE_SYS)
    {
       flags |= PAL_ZERO;
    }
+   if (around)
+   {
+      flags |= PAL_NOEVICT;
+   }
+
+   bool sharable = spe->location == FILE_SYS && (!spe->writable || !write);
+   struct share_key key;
+   if (sharable)
+   {
+      share_key_init(&key, t->exec_file, SHARE_EXEC_PAGE(spe->upage));
+      if (get_shared_page(spe->upage, false, &key))
+      {
+         return true;
+      }
+   }
 
    kpage = get_and_install_page(flags, 
                            spe->upage, 
                            t->pagedir, 
-                           spe->writable,
-                           spe->location == FILE_SYS && !spe->writable,
-                           t->file_name,
-                           (spe->absolute_off - (spe->absolute_off % PGSIZE)) / PGSIZE);
+                           spe->writable && !sharable);
    /* case when the get and install fails */
    if (kpage == NULL)
    { 
       return false;
    } 
-   if (spe->location == ALL_ZERO)
+   if (spe->location != FILE_SYS)
    {
+      release_installed_page(kpage, NULL);
       return true;
    }
 
 
    /* Load data into the page. */
    struct file *fp = t->exec_file;
-   lock_acquire(&file_lock);  
-   file_seek(fp, spe->absolute_off);
    off_t s;
-   if ((s = file_read (fp, kpage, spe->page_read_bytes)) 
+   if ((s = file_read_at (fp, kpage, spe->page_read_bytes, 
+                          spe->absolute_off)) 
          != (int) spe->page_read_bytes)
    {  
       printf("read: %u should have read:%u \n", s, spe->page_read_bytes);
-      lock_release(&file_lock);
+      release_installed_page(kpage, NULL);
       return false;
    }
-   lock_release(&file_lock);
    memset (kpage + spe->page_read_bytes, 0, PGSIZE - spe->page_read_bytes);
+   release_installed_page(kpage, sharable ? &key : NULL);
    return true;
 }
 
-/* function called when page faults for FILE_SYS or ALL_ZERO pages */
+/* function called when page faults for memory mapped pages;
+   AROUND as for actual_load_page() */
 static bool 
-actual_load_mmap_page(struct page_mmap_entry *pentry)
+actual_load_mmap_page(struct page_mmap_entry *pentry, bool around)
 {  
    struct thread *t = thread_current ();
-   uint8_t *kpage = get_and_install_page(PAL_USER, 
+   struct share_key key;
+   share_key_init(&key, pentry->fentry->file_pt, pentry->offset / PGSIZE);
+   if (get_shared_page(pentry->uaddr, true, &key))
+   {
+      return true;
+   }
+
+   uint8_t *kpage = get_and_install_page(around 
+                              ? PAL_USER | PAL_NOEVICT : PAL_USER, 
                            pentry->uaddr, 
                            t->pagedir, 
-                           true,
-                           true,
-                           pentry->fentry->file_name,
-                           (pentry->offset - (pentry->offset % PGSIZE)) / PGSIZE);
+                           true);
    /* case when the get and install fails */
    if (kpage == NULL)
    { 
@@ -400,99 +433,306 @@ actual_load_mmap_page(struct page_mmap_entry *pentry)
    }
 
    /* Load data into the page. */
+   /* At a fixed offset, as the evictor may be writing another page
+      of the same file back */
    struct file *fp = pentry->fentry->file_pt;
-   lock_acquire(&file_lock);
-   file_seek(fp, pentry->offset);
    off_t page_read_bytes = (file_length(fp) - pentry->offset) >= PGSIZE ? PGSIZE : file_length(fp) % PGSIZE;
-   file_read (pentry->fentry->file_pt, kpage, page_read_bytes);
-   lock_release(&file_lock);
+   file_read_at (fp, kpage, page_read_bytes, pentry->offset);
    memset (kpage + page_read_bytes, 0, PGSIZE - page_read_bytes);
+   release_installed_page(kpage, &key);
+   return true;
+}
+
+/* Maps the file pages of T next to UPAGE, which a fault has just
+   loaded, while the file is at hand: the other pages of the
+   FAULT_AROUND_PAGES-aligned block holding UPAGE that come from
+   the executable (FENTRY null) or from the same mapping FENTRY
+   and are not present yet.  Pages another process already has in
+   memory are simply shared; the rest are read, but only into
+   free frames, so fault-around never evicts.  T's spt_lock must
+   be held. */
+static void
+fault_around(struct thread *t, void *upage, struct file_mmap_entry *fentry)
+{
+   uint8_t *start = (uint8_t *) ((uintptr_t) upage
+                                 & ~(FAULT_AROUND_PAGES * PGSIZE - 1));
+   for (int i = 0; i < FAULT_AROUND_PAGES; i++)
+   {
+      void *p = start + i * PGSIZE;
+      if (p == upage || !is_user_vaddr(p)
+          || pagedir_get_page(t->pagedir, p) != NULL)
+      {
+         continue;
+      }
+
+      bool loaded;
+      if (fentry == NULL)
+      {
+         struct spt_entry *spe = find_spe(&t->sp_table, p);
+         if (spe == NULL || spe->location != FILE_SYS)
+         {
+            continue;
+         }
+         loaded = actual_load_page(spe, false, true);
+      }
+      else
+      {
+         struct page_mmap_entry *pentry 
+            = get_mmap_page(&t->page_mmap_table, p);
+         if (pentry == NULL || pentry->fentry != fentry)
+         {
+            continue;
+         }
+         loaded = actual_load_mmap_page(pentry, true);
+      }
+
+      /* Out of free frames: leave the rest to demand paging */
+      if (!loaded)
+      {
+         break;
+      }
+   }
+}
+
+/* Returns how many of the pages after SPE's, which is about to be
+   swapped in, to read ahead with it.  The window doubles while
+   swap-ins of T walk forward page by page and halves otherwise.
+   Only pages whose swap-slots directly follow SPE's are counted,
+   so the readahead is one contiguous read and never touches slots
+   of other processes.  T's spt_lock must be held. */
+static size_t
+readahead_count(struct thread *t, struct spt_entry *spe)
+{
+   if (spe->upage == t->ra_next)
+   {
+      t->ra_window = t->ra_window == 0 ? 1 : t->ra_window * 2;
+      if (t->ra_window > SWAP_READAHEAD_MAX)
+      {
+         t->ra_window = SWAP_READAHEAD_MAX;
+      }
+   }
+   else
+   {
+      t->ra_window /= 2;
+   }
+   t->ra_next = (uint8_t *) spe->upage + PGSIZE;
+
+   size_t n;
+   for (n = 0; n < t->ra_window; n++)
+   {
+      void *upage = (uint8_t *) spe->upage + (n + 1) * PGSIZE;
+      struct spt_entry *next = is_user_vaddr(upage)
+         ? find_spe(&t->sp_table, upage) : NULL;
+      if (next == NULL || next->location != SWAP_SLOT
+          || next->swap_slot != spe->swap_slot + n + 1)
+      {
+         break;
+      }
+   }
+   return n;
+}
+
+/* Handles a write by T to UPAGE, which is present but mapped
+   read-only.  Returns true if UPAGE is a writable page shared
+   copy-on-write, since a fork() or through the sharing table,
+   having made it T's own, so that the write can be retried.
+   Returns false if the write is a rights violation or there is
+   no frame left to copy to. */
+static bool
+copy_on_write(struct thread *t, void *upage)
+{
+   lock_acquire(&t->spt_lock);
+   struct spt_entry *spe = find_spe(&t->sp_table, upage);
+   uint8_t *kpage = pagedir_get_page(t->pagedir, upage);
+   if (spe == NULL || !spe->writable || kpage == NULL)
+   {
+      lock_release(&t->spt_lock);
+      return false;
+   }
+
+   /* share_lock keeps other processes from starting to share the
+      frame while we check */
+   lock_acquire(&share_lock);
+   struct frame_entry *fe = find_frame_entry(kpage);
+   ASSERT(fe);
+   if (fe->owners_list_size == 1)
+   {
+      /* The other sharers have taken copies or exited.  The page
+         is about to differ from the file, so nobody may find it
+         in the sharing table any more */
+      if (fe->share_entry)
+      {
+         delete_sharing_frame(&share_table, fe->share_entry);
+         fe->share_entry = NULL;
+      }
+      frame_release(fe);
+      lock_release(&share_lock);
+      pagedir_set_writable(t->pagedir, upage, true);
+      lock_release(&t->spt_lock);
+      return true;
+   }
+   lock_release(&share_lock);
+   if (fe->pinned)
+   {
+      /* Another sharer is reading it in a system call, or copying
+         it: let it finish and fault again */
+      frame_release(fe);
+      lock_release(&t->spt_lock);
+      thread_yield();
+      return true;
+   }
+
+   /* spt_lock keeps other threads from evicting the frame, but
+      allocating the copy may make this one evict it */
+   fe->pinned = true;
+   frame_release(fe);
+   uint8_t *copy = palloc_get_page(PAL_USER);
+   if (copy != NULL)
+   {
+      memcpy(copy, kpage, PGSIZE);
+   }
+   unpin_frame(kpage);
+   if (copy == NULL)
+   {
+      lock_release(&t->spt_lock);
+      return false;
+   }
+
+   /* Give up T's share of the old frame, which unmaps it */
+   palloc_free_page(kpage);
+   bool installed = install_page(upage, copy, true);
+   ASSERT(installed);
+   fe = find_frame_entry(copy);
+   ASSERT(fe);
+   bool added = frame_add_owner(fe, t, upage);
+   ASSERT(added);
+   frame_release(fe);
+
+   /* The contents are in no backing store yet */
+   pagedir_set_dirty(t->pagedir, upage, true);
+   release_installed_page(copy, NULL);
+   lock_release(&t->spt_lock);
    return true;
 }
 
+/* Returns the entry of the sharing table for the page KEY names,
+   or NULL if there is none or only one for another version of the
+   file, which is removed.  A frame that was only kept in memory
+   for such an entry is left for the evictor to reuse.  share_lock
+   must be held. */
+static struct share_entry *
+lookup_share(const struct share_key *key)
+{
+   struct share_entry *se = find_sharing_entry(&share_table, key);
+   if (se == NULL || se->key.version == key->version)
+   {
+      return se;
+   }
+
+   struct frame_entry *kframe_entry = find_frame_entry(se->kpage);
+   ASSERT(kframe_entry);
+   kframe_entry->share_entry = NULL;
+   frame_release(kframe_entry);
+   delete_sharing_frame(&share_table, se);
+   return NULL;
+}
+
+/* Maps the frame already holding the page KEY names, if another
+   process has loaded it or it is still cached from one that has
+   exited, at UPAGE.  Returns the frame, or null if there is none
+   to share. */
+uint8_t *
+get_shared_page(void *upage, bool writable, const struct share_key *key)
+{
+   lock_acquire(&share_lock);
+   struct share_entry *se = lookup_share(key);
+   uint8_t *kpage = se ? se->kpage : NULL;
+   if (kpage)
+   {
+      struct frame_entry *kframe_entry = find_frame_entry(kpage);
+      ASSERT(kframe_entry);
+
+      /* A pinned frame is on its way out; load a fresh copy */
+      if (kframe_entry->pinned || !install_page(upage, kpage, writable))
+      {
+         kpage = NULL;
+      }
+      else if (!frame_add_owner(kframe_entry, thread_current(), upage))
+      {
+         pagedir_clear_page(thread_current()->pagedir, upage);
+         kpage = NULL;
+      }
+      frame_release(kframe_entry);
+   }
+   lock_release(&share_lock);
+   return kpage;
+}
+
 /* pallocs and intsalls upage in the current thread's directory
-if not already instlaled (sharing); returns null when fails */
+if not already instlaled; returns null when fails.  The frame is
+returned pinned, so it cannot be evicted while it is being filled:
+the caller must release_installed_page() it afterwards. */
 uint8_t *
 get_and_install_page(enum palloc_flags flags, 
                      void *upage, 
                      uint32_t *pagedir, 
-                     bool writable,
-                     bool sharable,
-                     char *name,
-                     unsigned int page_num)
+                     bool writable)
 {
    uint8_t *kpage = pagedir_get_page (pagedir, upage);
 
-   if (kpage == NULL)
-   {
-    bool prev_frame = re_lock_acquire(&frame_lock);
-    lock_acquire(&share_lock);
-
-    struct owner *frame_owner = malloc(sizeof(struct owner));
-    frame_owner->t = thread_current();
-    frame_owner->upage = upage;
-
-    if (sharable)
-    {
-      void *kpage = find_sharing_entry(&share_table, name, page_num);
-      if (kpage)
+   if (kpage != NULL)
+   {  
+     /* Check if writable flag for the page should be updated */
+     if(writable && !pagedir_is_writable(pagedir, upage))
       {
-        /* Add the page to the process's address space. */
-        if (!install_page (upage, kpage, writable)) 
-        {
-          free(frame_owner);
-          lock_release(&share_lock);
-          re_lock_release(&frame_lock, prev_frame);
-          return NULL; 
-        }
-        struct frame_entry *kframe_entry = find_frame_entry(&frame_table, kpage);
-        list_push_back(&kframe_entry->owners, &frame_owner->elem);
-        kframe_entry->owners_list_size++;
-        lock_release(&share_lock);
-        re_lock_release(&frame_lock, prev_frame);
-        return kpage;
-      }      
-    }
+       pagedir_set_writable(pagedir, upage, writable); 
+      }
+     return kpage;
+   }
 
    /* Get a new page of memory. */
    kpage = palloc_get_page (flags);
    if (kpage == NULL)
    {   
-    free(frame_owner);
-    lock_release(&share_lock);
-    re_lock_release(&frame_lock, prev_frame);
-    return NULL;
+     return NULL;
+   }
+
+   /* Add the page to the process's address space. */
+   if (!install_page (upage, kpage, writable)) 
+   {
+     palloc_free_page (kpage);
+     return NULL; 
    }
-    
-   struct frame_entry *kframe_entry;
-   kframe_entry = find_frame_entry(&frame_table, kpage);
-   list_push_back(&kframe_entry->owners, &frame_owner->elem);
-   kframe_entry->owners_list_size++;
-
-     /* Add the page to the process's address space. */
-     if (!install_page (upage, kpage, writable)) 
+
+   /* The first owner is stored inline, so this cannot fail */
+   struct frame_entry *kframe_entry = find_frame_entry(kpage);
+   ASSERT(kframe_entry);
+   bool added = frame_add_owner(kframe_entry, thread_current(), upage);
+   ASSERT(added);
+   frame_release(kframe_entry);
+   return kpage;
+}
+
+/* Makes the frame KPAGE returned by get_and_install_page()
+   evictable again now that it holds its data.  Unless KEY is
+   null, the frame is first published as holding the page KEY
+   names, unless another process got there first. */
+void
+release_installed_page(void *kpage, const struct share_key *key)
+{
+   if (key != NULL)
+   {
+     lock_acquire(&share_lock);
+     if (lookup_share(key) == NULL)
      {
-      palloc_free_page (kpage);
-      lock_release(&share_lock);
-      re_lock_release(&frame_lock, prev_frame);
-      return NULL; 
+       struct share_entry *se 
+          = insert_sharing_entry(&share_table, key, kpage);
+       struct frame_entry *kframe_entry = find_frame_entry(kpage);
+       ASSERT(kframe_entry);
+       kframe_entry->share_entry = se;
+       frame_release(kframe_entry);
      }
-
-    if (sharable) {
-      ASSERT(kframe_entry);
-      kframe_entry->inner_entry 
-         = insert_sharing_entry(&share_table, name, page_num, kpage);
-    }
      lock_release(&share_lock);
-     re_lock_release(&frame_lock, prev_frame);
-   } 
-   else 
-   {  
-     /* Check if writable flag for the page should be updated */
-     if(writable && !pagedir_is_writable(pagedir, upage))
-      {
-       pagedir_set_writable(pagedir, upage, writable); 
-      }
    }
-   return kpage;
-}
\ No newline at end of file
+   unpin_frame(kpage);
+}
@@ -13,13 +13,16 @@
 
 void exception_init (void);
 void exception_print_stats (void);
+struct share_key;
+
+uint8_t *
+get_shared_page(void *upage, bool writable, const struct share_key *key);
 uint8_t *
 get_and_install_page(enum palloc_flags flags, 
                      void *upage, 
                      uint32_t *pagedir, 
-                     bool writable,
-                     bool is_filesys,
-                     char *name,
-                     unsigned int page_num);
+                     bool writable);
+void
+release_installed_page(void *kpage, const struct share_key *key);
 
 #endif /* userprog/exception.h */
@@ -23,9 +23,24 @@
 #include "threads/vaddr.h"
 #include "vm/spt.h"
 #include "vm/mmap.h"
+#include "vm/frame.h"
+#include "devices/swap.h"
 
 static thread_func start_process NO_RETURN;
+static thread_func start_fork NO_RETURN;
 static bool load (char *cmdline, void (**eip) (void), void **esp);
+static tid_t wait_for_start (tid_t tid);
+static bool fork_address_space (struct thread *parent);
+static bool fork_page (struct thread *parent, struct spt_entry *spe);
+static bool fork_files (struct thread *parent);
+
+/* What a child started by process_fork() copies from its parent,
+   which waits for it to do so. */
+struct fork_args
+  {
+    struct thread *parent;
+    struct intr_frame *if_;     /* Parent's user context. */
+  };
 
 /* Starts a new thread running a user program loaded from
    FILENAME.  The new thread may be scheduled (and may even exit)
@@ -69,8 +84,14 @@ process_execute (const char *file_name)
     palloc_free_page (fn_copy);
     return TID_ERROR;
   }
-    
+  return wait_for_start (tid);
+}
 
+/* Waits until the child TID has set up its process and returns
+   TID, or TID_ERROR if it failed to. */
+static tid_t
+wait_for_start (tid_t tid)
+{
   struct list_elem *e;
   for (e = list_begin(&thread_current()->baby_sitters); 
        e != list_end(&thread_current()->baby_sitters);
@@ -127,6 +148,186 @@ start_process (void *fn_copy)
   NOT_REACHED ();
 }
 
+/* Starts a copy of the current process, which returns from the
+   system call with user context IF_ just as its parent does, but
+   with 0 in eax.  The memory of the parent is not copied but
+   shared copy-on-write.  Returns the child's thread id, or
+   TID_ERROR if the child cannot be created. */
+tid_t
+process_fork (struct intr_frame *if_)
+{
+  struct thread *cur = thread_current ();
+  struct fork_args args;
+  tid_t tid;
+
+  args.parent = cur;
+  args.if_ = if_;
+  tid = thread_create (cur->name, PRI_DEFAULT, start_fork, &args);
+  if (tid == TID_ERROR)
+    return TID_ERROR;
+  return wait_for_start (tid);
+}
+
+/* A thread function that copies the process of the parent in
+   struct fork_args ARGS and starts it running. */
+static void
+start_fork (void *args_)
+{
+  struct fork_args *args = args_;
+  struct thread *parent = args->parent;
+  struct intr_frame if_ = *args->if_;
+  bool success;
+
+  success = fork_address_space (parent) && fork_files (parent);
+  thread_current()->nanny->start_process_success = success;
+  if_.eax = 0;
+
+  /* ARGS is gone once the parent runs again */
+  enum intr_level old_level = intr_disable();
+  sema_up (&thread_current()->nanny->start_process_sema);
+  if (!success)
+  { 
+    delete_thread(-1);
+  }
+  intr_set_level(old_level);
+
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Gives the current thread a copy of the supplemental page
+   table, memory mappings and page directory of PARENT.  Both
+   spt_locks are held throughout, so the evictor leaves the frames
+   of either alone while they are shared. */
+static bool
+fork_address_space (struct thread *parent)
+{
+  struct thread *t = thread_current ();
+  struct hash_iterator i;
+  bool success = false;
+
+  lock_init(&t->spt_lock);
+  lock_acquire(&t->spt_lock);
+  t->ra_next = NULL;
+  t->ra_window = 0;
+  if (!generate_spt_table(&t->sp_table)
+      || !generate_mmap_tables(&t->page_mmap_table, &t->file_mmap_table))
+  {
+    lock_release(&t->spt_lock);
+    return false;
+  }
+
+  t->pagedir = pagedir_create ();
+  if (t->pagedir == NULL) 
+  {
+    lock_release(&t->spt_lock);
+    return false;
+  }
+  process_activate ();
+
+  lock_acquire(&parent->spt_lock);
+  hash_first (&i, &parent->sp_table);
+  while (hash_next (&i))
+    if (!fork_page (parent, hash_entry (hash_cur (&i),
+                                        struct spt_entry, elem)))
+      goto done;
+  success = copy_mmap_tables(parent);
+
+ done:
+  lock_release(&parent->spt_lock);
+  lock_release(&t->spt_lock);
+  return success;
+}
+
+/* Copies page SPE of PARENT to the current thread.  A page PARENT
+   has in memory is shared instead: both map its frame read-only,
+   and if the page is writable the first of them to write to it
+   takes a copy of its own, see copy_on_write() in exception.c.
+   A swapped out page gets a swap-slot of its own. */
+static bool
+fork_page (struct thread *parent, struct spt_entry *spe)
+{
+  struct thread *t = thread_current ();
+  struct spt_entry *copy = kmem_cache_alloc(spe_cache);
+  if (copy == NULL)
+    return false;
+
+  *copy = *spe;
+  copy->clean_slot = NO_SWAP_SLOT;
+  if (spe->location == SWAP_SLOT)
+    {
+      copy->swap_slot = swap_copy (spe->swap_slot);
+      if (copy->swap_slot == NO_SWAP_SLOT)
+        {
+          kmem_cache_free (spe_cache, copy);
+          return false;
+        }
+    }
+  ASSERT(!insert_spe(&t->sp_table, copy));
+
+  void *kpage = pagedir_get_page (parent->pagedir, spe->upage);
+  if (kpage == NULL)
+    return true;
+
+  /* Where PARENT's copy is dirty, or clean only because the
+     cleaner saved it to PARENT's slot, the child's is dirty too,
+     or the evictor would drop it */
+  bool dirty = pagedir_is_dirty (parent->pagedir, spe->upage)
+               || spe->clean_slot != NO_SWAP_SLOT;
+
+  struct frame_entry *fe = find_frame_entry (kpage);
+  ASSERT(fe);
+  bool shared = pagedir_set_page (t->pagedir, spe->upage, kpage, false);
+  if (shared && !frame_add_owner (fe, t, spe->upage))
+    {
+      pagedir_clear_page (t->pagedir, spe->upage);
+      shared = false;
+    }
+  frame_release (fe);
+  if (!shared)
+    return false;
+
+  pagedir_set_dirty (t->pagedir, spe->upage, dirty);
+  if (spe->writable)
+    pagedir_set_writable (parent->pagedir, spe->upage, false);
+  return true;
+}
+
+/* Gives the current thread the open files and executable of
+   PARENT.  Each file is reopened at the same position, which the
+   two processes then move independently. */
+static bool
+fork_files (struct thread *parent)
+{
+  struct thread *t = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&parent->fds); e != list_end (&parent->fds);
+       e = list_next (e))
+    {
+      struct fd_st *pfd = list_entry (e, struct fd_st, elem);
+      struct fd_st *fd_obj = kmem_cache_alloc (fd_cache);
+      if (fd_obj == NULL)
+        return false;
+      fd_obj->file_pt = file_reopen (pfd->file_pt);
+      if (fd_obj->file_pt == NULL)
+        {
+          kmem_cache_free (fd_cache, fd_obj);
+          return false;
+        }
+      file_seek (fd_obj->file_pt, file_tell (pfd->file_pt));
+      fd_obj->fd = pfd->fd;
+      strlcpy (fd_obj->file_name, pfd->file_name, MAX_FILE_NAME_SIZE);
+      list_push_back (&t->fds, &fd_obj->elem);
+    }
+
+  t->exec_file = file_reopen (parent->exec_file);
+  if (t->exec_file == NULL)
+    return false;
+  file_deny_write (t->exec_file);
+  return true;
+}
+
 /* Waits for thread TID to die and returns its exit status. 
  * If it was terminated by the kernel (i.e. killed due to an exception), 
  * returns -1.  
@@ -169,11 +370,11 @@ process_exit (void)
 
   uint32_t *pd;
       
-  /* destroy supplemental page_table */
-  bool prev_frame = re_lock_acquire(&frame_lock);
+  /* destroy supplemental page_table.  spt_lock is held until the
+     page directory is gone, so the evictor leaves our frames alone
+     while they are torn down */
   bool prev_spt = re_lock_acquire(&cur->spt_lock);
   destroy_spt_table(&cur->sp_table);
-  re_lock_release(&cur->spt_lock, prev_spt);
 
   destroy_mmap_tables();
 
@@ -193,7 +394,7 @@ process_exit (void)
       pagedir_activate (NULL);
       pagedir_destroy (pd);
     }
-  re_lock_release(&frame_lock, prev_frame);
+  re_lock_release(&cur->spt_lock, prev_spt);
 }
 
 /* Sets up the CPU for running user code in the current
@@ -301,22 +502,22 @@ load (char *file_name, void (**eip) (void), void **esp)
     goto done;
   process_activate ();
 
-  /* supplemental page table intialisation */
+  /* supplemental page table intialisation; spt_lock is held for the
+     whole load */
   lock_init(&t->spt_lock);
-  lock_acquire(&frame_lock);
   lock_acquire(&t->spt_lock);
+  t->ra_next = NULL;
+  t->ra_window = 0;
   if (!generate_spt_table(&t->sp_table))
   {
     lock_release(&t->spt_lock);
-    lock_release(&frame_lock);
     return false;
   }
-  lock_release(&t->spt_lock);
 
   /* Memory mapped files table initialization */
   if (!generate_mmap_tables(&t->page_mmap_table, &t->file_mmap_table))
   {
-    lock_release(&frame_lock);
+    lock_release(&t->spt_lock);
     return false;
   }
 
@@ -326,7 +527,6 @@ load (char *file_name, void (**eip) (void), void **esp)
   char *saveptr;
 
   /* Open executable file. */
-  lock_acquire(&file_lock);
   file = filesys_open (strtok_r(file_name, " ", &saveptr));
   if (file == NULL) 
     {
@@ -413,8 +613,6 @@ load (char *file_name, void (**eip) (void), void **esp)
         }
     }
   
-  strlcpy(t->file_name, file_name, MAX_FILE_NAME_SIZE);
-
   /* Set up stack. */
   if (!setup_stack (esp, file_name, saveptr))
   {
@@ -429,8 +627,7 @@ load (char *file_name, void (**eip) (void), void **esp)
  done:
   /* We arrive here whether the load is successful or not. */
   file_close (file);
-  lock_release(&file_lock);
-  lock_release(&frame_lock);
+  lock_release(&t->spt_lock);
   return success;
 }
 
@@ -514,15 +711,15 @@ load_segment (off_t ofs, uint8_t *upage,
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
           
-      /* LAZY LOADING */
+      /* LAZY LOADING, load() holds spt_lock */
       struct thread *t = thread_current();
-      lock_acquire(&t->spt_lock);
-      struct spt_entry *spe = malloc(sizeof(struct spt_entry));
+      struct spt_entry *spe = kmem_cache_alloc(spe_cache);
       spe->upage = upage;
       spe->writable = writable;
       spe->page_read_bytes = page_read_bytes;
       spe->absolute_off = ofs + last_page_read_bytes;
       spe->location = (page_read_bytes == 0) ? ALL_ZERO : FILE_SYS;
+      spe->clean_slot = NO_SWAP_SLOT;
 
       
       struct hash_elem *he = insert_spe(&t->sp_table, spe);
@@ -530,9 +727,8 @@ load_segment (off_t ofs, uint8_t *upage,
       {
         // this means an equal element is already in the hash table
         update_spe(hash_entry(he, struct spt_entry, elem), spe);
-        free(spe);
+        kmem_cache_free(spe_cache, spe);
       }
-      lock_release(&t->spt_lock);
 
       /* Advance. */
       read_bytes -= page_read_bytes;
@@ -553,19 +749,21 @@ setup_stack (void **esp, char *fn_copy, char *saveptr)
   uint8_t *kpage = get_and_install_page(PAL_USER | PAL_ZERO, 
                        ((uint8_t *) PHYS_BASE) - PGSIZE,
                        t->pagedir,
-                       true, false, NULL, -1);
+                       true);
   ASSERT(kpage);
   if (kpage != NULL) 
     { 
-      lock_acquire(&t->spt_lock);
+      /* load() holds spt_lock, which keeps the page resident while
+         the arguments are pushed */
+      release_installed_page(kpage, NULL);
       *esp = PHYS_BASE;
       /* Establishing initial stack page for current thread */
-      struct spt_entry * spe = malloc(sizeof(struct spt_entry));
+      struct spt_entry * spe = kmem_cache_alloc(spe_cache);
       spe -> upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
       spe -> location = STACK;
       spe -> writable = true;
+      spe -> clean_slot = NO_SWAP_SLOT;
       ASSERT(!insert_spe(&t->sp_table, spe));
-      lock_release(&t->spt_lock);
 
       /* Total bytes required for stack setup */
       unsigned total_bytes = strlen(fn_copy) + 1;
@@ -4,6 +4,8 @@
 #include "threads/thread.h"
 #include "threads/synch.h"
 
+struct intr_frame;
+
 bool install_page (void *upage, void *kpage, bool writable);
 
 /* struct to maintain a child-parent relationship for exit statuses */
@@ -26,6 +28,7 @@ struct baby_sitter {
 };
 
 tid_t process_execute (const char *file_name);
+tid_t process_fork (struct intr_frame *);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
@@ -12,11 +12,13 @@
 #include "threads/malloc.h"
 #include "devices/shutdown.h"
 #include "devices/input.h"
+#include "devices/timer.h"
 #include "lib/stdio.h"
 #include "lib/string.h"
 #include "userprog/pagedir.h"
 #include "vm/spt.h"
 #include "vm/mmap.h"
+#include "vm/frame.h"
 
 static void syscall_handler (struct intr_frame *);
 static int get_word (const uint8_t *uaddr);
@@ -24,13 +26,14 @@ static int get_user (const uint8_t *uaddr);
 static int get_byte (const uint8_t *uaddr);
 static bool put_user (uint8_t *udst, uint8_t byte);
 static bool put_byte (uint8_t *udst, uint8_t byte);
+static uint8_t *pin_user (uint8_t *uaddr, bool write);
+static void unpin_user (uint8_t *uaddr, uint8_t *kaddr, bool write);
+static int copy_to_user (uint8_t *udst, struct file *file, int size);
+static int copy_from_user (struct file *file, const uint8_t *usrc, int size);
 static int allocate_fd (void);
 static struct fd_st *get_fd (int fd);
 static bool validate_filename(const uint8_t * word);
 
-/* Struct to store child-parent relationship */
-struct lock file_lock; 
-
 /* Type of functions for sys call handlers */
 typedef intr_handler_func syscall_handler_func;
 
@@ -50,17 +53,21 @@ syscall_handler_func tell_handler;
 syscall_handler_func close_handler;
 syscall_handler_func mmap_handler;
 syscall_handler_func munmap_handler;
+syscall_handler_func fork_handler;
+syscall_handler_func ticks_handler;
 
 /* Array of syscall structs respective system calls */
 static syscall_handler_func *handlers[NUM_SYS_CALLS];
 
+/* Cache the file descriptor objects are allocated from */
+struct kmem_cache *fd_cache;
+
 void
 syscall_init (void) 
 {
   intr_register_int (SYSCALL_INTR_NUM, 3, INTR_ON, syscall_handler, "syscall");
+  fd_cache = kmem_cache_create ("fd_st", sizeof (struct fd_st), NULL);
 
-  lock_init(&file_lock);
-  
   /* Intialising the handlers array with sys call structs */
   handlers[SYS_HALT] = &halt_handler;            
   handlers[SYS_EXIT] = &exit_handler;                  
@@ -77,6 +84,8 @@ syscall_init (void)
   handlers[SYS_CLOSE] = &close_handler;
   handlers[SYS_MMAP] = &mmap_handler;
   handlers[SYS_MUNMAP] = &munmap_handler;
+  handlers[SYS_FORK] = &fork_handler;
+  handlers[SYS_TICKS] = &ticks_handler;
 }
 
 static void
@@ -175,6 +184,146 @@ put_byte (uint8_t *udst, uint8_t byte)
   return is_user_vaddr(udst) && put_user(udst, byte);
 }
 
+/* Makes the user page holding UADDR present, and writable if
+   WRITE, the way an access by the user would, then pins its frame
+   so that it stays so until unpin_user().  Returns the kernel
+   address UADDR is mapped at, or NULL if the access would fault.
+   No lock may be held: making the page present can fault. */
+static uint8_t *
+pin_user (uint8_t *uaddr, bool write)
+{
+  struct thread *t = thread_current ();
+  void *upage = pg_round_down (uaddr);
+  while (true)
+  {
+    int byte = get_byte (uaddr);
+    if (byte == -1 || (write && !put_byte (uaddr, byte)))
+    {
+      return NULL;
+    }
+
+    /* Holding spt_lock keeps the evictor off the page, so it is
+       still present when we come to pin it */
+    lock_acquire (&t->spt_lock);
+    uint8_t *kpage = pagedir_get_page (t->pagedir, upage);
+    bool pinned = false;
+    struct frame_entry *fe = kpage ? find_frame_entry (kpage) : NULL;
+    if (fe != NULL)
+    {
+      if (!fe->pinned)
+      {
+        fe->pinned = pinned = true;
+      }
+      frame_release (fe);
+    }
+    lock_release (&t->spt_lock);
+
+    if (pinned)
+    {
+      return kpage + pg_ofs (uaddr);
+    }
+    /* Evicted since we touched it, or pinned by another process
+       sharing it: wait for that to finish */
+    thread_yield ();
+  }
+}
+
+/* Undoes pin_user(UADDR, WRITE), which returned KADDR.  Writes
+   through KADDR bypass the user's page table, so the page is
+   marked dirty here for the evictor to save it. */
+static void
+unpin_user (uint8_t *uaddr, uint8_t *kaddr, bool write)
+{
+  if (write)
+  {
+    pagedir_set_dirty (thread_current ()->pagedir, pg_round_down (uaddr), 
+                       true);
+  }
+  unpin_frame (pg_round_down (kaddr));
+}
+
+/* Reads up to SIZE bytes from FILE into user memory at UDST.
+   Each user page is pinned and read into directly, so there is
+   no bounce buffer and no page fault with the inode locked.  Returns
+   the number of bytes read, or -1 if UDST is not valid user
+   memory, in which case some bytes may have been read. */
+static int
+copy_to_user (uint8_t *udst, struct file *file, int size)
+{
+  int done = 0;
+  while (done < size)
+  {
+    uint8_t *uaddr = udst + done;
+    int chunk = PGSIZE - pg_ofs (uaddr);
+    if (chunk > size - done)
+    {
+      chunk = size - done;
+    }
+
+    uint8_t *kaddr = pin_user (uaddr, true);
+    if (kaddr == NULL)
+    {
+      return -1;
+    }
+    int n = file_read (file, kaddr, chunk);
+    unpin_user (uaddr, kaddr, true);
+
+    done += n;
+    if (n < chunk)
+    {
+      break;
+    }
+  }
+  return done;
+}
+
+/* Writes SIZE bytes from user memory at USRC to FILE, or to the
+   console if FILE is null, a pinned user page at a time.  Returns
+   the number of bytes written, or -1 if USRC is not valid user
+   memory, in which case some bytes may have been written. */
+static int
+copy_from_user (struct file *file, const uint8_t *usrc, int size)
+{
+  int max_chunk = file ? PGSIZE : STDOUT_MAX_BUFFER_SIZE;
+  int done = 0;
+  while (done < size)
+  {
+    uint8_t *uaddr = (uint8_t *) usrc + done;
+    int chunk = PGSIZE - pg_ofs (uaddr);
+    if (chunk > max_chunk)
+    {
+      chunk = max_chunk;
+    }
+    if (chunk > size - done)
+    {
+      chunk = size - done;
+    }
+
+    uint8_t *kaddr = pin_user (uaddr, false);
+    if (kaddr == NULL)
+    {
+      return -1;
+    }
+    int n = chunk;
+    if (file == NULL)
+    {
+      putbuf ((const char *) kaddr, chunk);
+    }
+    else
+    {
+      n = file_write (file, kaddr, chunk);
+    }
+    unpin_user (uaddr, kaddr, false);
+
+    done += n;
+    if (n < chunk)
+    {
+      break;
+    }
+  }
+  return done;
+}
+
 /* System call functions */
 void 
 halt_handler(struct intr_frame *f UNUSED) 
@@ -214,6 +363,18 @@ exit_handler(struct intr_frame *f)
   thread_exit();
 }
 
+void
+fork_handler(struct intr_frame *f)
+{
+  f->eax = process_fork(f);
+}
+
+void
+ticks_handler(struct intr_frame *f)
+{
+  f->eax = (uint32_t) timer_ticks();
+}
+
 void
 wait_handler(struct intr_frame *f) 
 {
@@ -229,14 +390,12 @@ open_handler(struct intr_frame *f)
 { 
   
   int word = get_word(f->esp + sizeof(void *));
-  struct fd_st *fd_obj = malloc(sizeof(struct fd_st));
+  struct fd_st *fd_obj = kmem_cache_alloc(fd_cache);
   
-  lock_acquire(&file_lock);
   fd_obj->fd = allocate_fd();
   if (word == -1 || !validate_filename((const uint8_t *) word))
   { 
-    lock_release(&file_lock);
-    free(fd_obj);
+    kmem_cache_free(fd_cache, fd_obj);
     delete_thread(-1);
   }
   strlcpy(fd_obj->file_name, (char *) word, MAX_FILE_NAME_SIZE);
@@ -245,8 +404,7 @@ open_handler(struct intr_frame *f)
   
   if (!fd_obj->file_pt)
   {
-    lock_release(&file_lock);
-    free(fd_obj);
+    kmem_cache_free(fd_cache, fd_obj);
     thread_current()->exit_status = 0;
 
     enum intr_level old_level = intr_disable();
@@ -262,7 +420,6 @@ open_handler(struct intr_frame *f)
   }
   
   list_push_back(&thread_current()->fds, &fd_obj->elem);
-  lock_release(&file_lock);
   
   f->eax = fd_obj->fd;
 }
@@ -273,17 +430,13 @@ filesize_handler(struct intr_frame *f)
   int fd = get_word(f->esp + sizeof(void *));
   struct fd_st *fd_obj;
 
-  lock_acquire(&file_lock);
-  
   if ((fd_obj = get_fd(fd)) == NULL)
   {
-    lock_release(&file_lock);
     f->eax = 0xffffffff;
     return;
   }
   
   f->eax = file_length(fd_obj->file_pt);
-  lock_release(&file_lock);
 }
 
 void
@@ -311,30 +464,19 @@ read_handler(struct intr_frame *f)
     return;
   }
 
-  /* Create a fd object only when necessary */
-  lock_acquire(&file_lock);
   struct fd_st *fd_obj = get_fd(fd);
   if (fd_obj == NULL)
   {
     f->eax = 0xffffffff;
-    lock_release(&file_lock);
     return;
   }
 
-  /* Create a temporary buffer for reading using file struct */
-  uint8_t *temp_buf = malloc(size * sizeof(uint8_t));
-  int actual_read = file_read(fd_obj->file_pt, temp_buf, size);
-  lock_release(&file_lock);
-
-  for (int i = 0; i < actual_read; i++)
-  { 
-    if (!put_byte((uint8_t *)buffer + i, temp_buf[i]))
-    {
-      delete_thread(-1);
-    }
+  /* Read straight into the user's pages */
+  int actual_read = copy_to_user((uint8_t *) buffer, fd_obj->file_pt, size);
+  if (actual_read == -1)
+  {
+    delete_thread(-1);
   }
-
-  free(temp_buf);
   f->eax = actual_read;
 }
 
@@ -352,50 +494,26 @@ write_handler(struct intr_frame *f UNUSED)
     delete_thread(-1);
   }
   
-  /* Writing from user mem buffer to temp buffer */
-  uint8_t *temp_buffer = malloc(size * sizeof(uint8_t));
-  for (int i = 0; i < size; i++)
-  { 
-    int byte = get_byte((const uint8_t *)buffer + i);
-    if (byte == -1)
-    {
-      delete_thread(-1);
-    }
-    temp_buffer[i] = (uint8_t) byte;
-  }
-  
-  if (fd == STDOUT_FILENO) 
+  struct file *file = NULL;
+  if (fd != STDOUT_FILENO) 
   {
-    /* Writing out to putbuf in multiples of STDOUT_MAX_BUFFER_SIZE */
-    for (int i = 0; i < size; i += STDOUT_MAX_BUFFER_SIZE)
+    struct fd_st *fd_obj = get_fd(fd);
+    if (fd_obj == NULL)
     { 
-      size_t actual_size = (size - i * STDOUT_MAX_BUFFER_SIZE) < STDOUT_MAX_BUFFER_SIZE 
-      ? (size - i * STDOUT_MAX_BUFFER_SIZE)
-      : STDOUT_MAX_BUFFER_SIZE; 
-      putbuf ((const char *) temp_buffer + i, actual_size);
+      f->eax = 0;
+      return;
     }
-
-    f->eax = size;
-    free(temp_buffer);
-    return;
+    file = fd_obj->file_pt;
   }
 
-  /* Create a fd object only when necessary */
-  lock_acquire(&file_lock);
-  struct fd_st *fd_obj = get_fd(fd);
-  if (fd_obj == NULL)
-  { 
-    lock_release(&file_lock);
-    f->eax = 0;
-    free(temp_buffer);
-    return;
+  /* Write straight from the user's pages, to the console in
+     pieces of at most STDOUT_MAX_BUFFER_SIZE */
+  int written = copy_from_user(file, (const uint8_t *) buffer, size);
+  if (written == -1)
+  {
+    delete_thread(-1);
   }
-
-  /* Write out to file */
-  f->eax = file_write(fd_obj->file_pt, temp_buffer, size);
-  lock_release(&file_lock);
-
-  free(temp_buffer);
+  f->eax = written;
 }
 
 void
@@ -411,9 +529,7 @@ create_handler(struct intr_frame *f)
     delete_thread(-1);
   } 
 
-  lock_acquire(&file_lock);
   f->eax = filesys_create ((const char *) file_name, initial_size);
-  lock_release(&file_lock);
 }
 
 void
@@ -421,9 +537,7 @@ remove_handler(struct intr_frame *f)
 {
   int file_name = get_word(f->esp + sizeof(void *));
 
-  lock_acquire(&file_lock);
   f->eax = filesys_remove ((const char *) file_name);
-  lock_release(&file_lock);
 }
 
 void
@@ -433,16 +547,13 @@ seek_handler(struct intr_frame *f)
   int new_pos = get_word(f->esp + sizeof(void *) * 2);
   struct fd_st *fd_obj;
   
-  lock_acquire(&file_lock);
   if (fd == -1 
       || new_pos == -1 
       || (fd_obj = get_fd(fd)) == NULL)
   {
-    lock_release(&file_lock);
     return;
   }
   file_seek(fd_obj->file_pt, (unsigned) new_pos);
-  lock_release(&file_lock);
 }
 
 void
@@ -451,15 +562,12 @@ tell_handler(struct intr_frame *f)
   int fd = get_word(f->esp + sizeof(void *));
   struct fd_st *fd_obj;
 
-  lock_acquire(&file_lock);
   if (fd == -1 
       || (fd_obj = get_fd(fd)) == NULL)
   {
-    lock_release(&file_lock);
     return;
   }
   f->eax = file_tell(fd_obj->file_pt);
-  lock_release(&file_lock);
 }
 
 void
@@ -468,19 +576,16 @@ close_handler(struct intr_frame *f)
   int fd = get_word(f->esp + sizeof(void *));
   struct fd_st *fd_obj;
 
-  lock_acquire(&file_lock);
   if (fd == -1 
       || (fd_obj = get_fd(fd)) == NULL)
   {
-    lock_release(&file_lock);
     return;
   }
 
   file_close(fd_obj->file_pt);
-  lock_release(&file_lock);
 
   list_remove(&fd_obj->elem);
-  free(fd_obj);
+  kmem_cache_free(fd_cache, fd_obj);
 }
 
 
@@ -489,7 +594,10 @@ static int
 allocate_fd (void) 
 {
   static int next_fd = 2;
-  return next_fd++;
+  enum intr_level old_level = intr_disable();
+  int fd = next_fd++;
+  intr_set_level(old_level);
+  return fd;
 }
 
 /* Returns 'struct fd' if fd is valid for current thread else returns null */
@@ -554,7 +662,6 @@ mmap_handler(struct intr_frame *f)
   void *last_page = pg_round_down((void *) (addr + flength));
 
   // TODO: macro for -1
-  lock_acquire(&file_lock);
   if (fd == -1
       || addr <= 0
       || ((unsigned) addr) % PGSIZE != 0
@@ -565,11 +672,9 @@ mmap_handler(struct intr_frame *f)
       || !is_user_vaddr((void *) addr)
       || !is_user_vaddr(last_page))
   {
-        lock_release(&file_lock);
         f->eax = -1;
         return;
   }
-  lock_release(&file_lock);
 
   struct thread *t = thread_current();
 
@@ -610,5 +715,7 @@ munmap_handler(struct intr_frame *f)
   }
   struct file_mmap_entry *fentry = hash_entry(fentry_he, struct file_mmap_entry, elem);
 
+  lock_acquire(&t->spt_lock);
   unmap_entry(&t->page_mmap_table, &t->file_mmap_table, fentry, true);
+  lock_release(&t->spt_lock);
 }
\ No newline at end of file
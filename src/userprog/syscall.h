@@ -3,15 +3,13 @@
 
 #include "lib/kernel/list.h"
 
-#define NUM_SYS_CALLS 20
+#define NUM_SYS_CALLS 22
 #define SYSCALL_INTR_NUM 0x30
 #define STDOUT_MAX_BUFFER_SIZE 500
 #define MAX_FILE_NAME_SIZE 14
 #define USER_STACK_LOWER_BOUND 0xbffff000
 #define SYS_HANDLERS_SIZE 13
 
-extern struct lock file_lock;
-
 /* struct for the file descriptor objects owned by threads */
 struct fd_st {
     int fd;
@@ -20,6 +18,8 @@ struct fd_st {
     struct list_elem elem;
 };
 
+extern struct kmem_cache *fd_cache;
+
 void syscall_init (void);
 void delete_thread (int exit_stat);
 
@@ -0,0 +1,252 @@
+#include "cleaner.h"
+#include <debug.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "userprog/pagedir.h"
+#include "devices/swap.h"
+#include "frame.h"
+#include "spt.h"
+
+/* Page cleaner.  A kernel thread that walks the frames the clock
+   will reach next and writes dirty, swap-backed pages to swap
+   ahead of time, leaving them resident but clean.  The evictor
+   can then reuse such a frame straight away: it only has to note
+   the slot in the spt_entry instead of writing the page out in
+   the middle of a page fault.
+
+   The cleaner is woken once fewer than low_water frames ahead
+   of the hand are known to be free or clean, and then cleans
+   until high_water of them are. */
+
+static size_t low_water;
+static size_t high_water;
+
+/* Frames ahead of the hand found free or clean by the last pass,
+   less the evictions since.  Guarded by disabling interrupts. */
+static size_t clean_cnt;
+
+/* True while the cleaner has been woken and not yet finished */
+static bool cleaning;
+
+static struct semaphore cleaner_sema;
+
+static thread_func cleaner_thread;
+struct clean_batch;
+static size_t clean_ahead(void);
+static bool clean_frame(struct frame_entry *fe, struct clean_batch *b);
+static size_t flush_batch(struct clean_batch *b);
+
+/* Starts the cleaner, unless HIGH is 0 or there is no swap space
+   to clean to. */
+void
+cleaner_init(size_t low, size_t high)
+{
+    if (high < low)
+    {
+        high = low;
+    }
+    low_water = low;
+    high_water = high;
+    clean_cnt = frame_count();
+    cleaning = false;
+    sema_init(&cleaner_sema, 0);
+
+    if (high_water > 0 && swap_slot_count() > 0)
+    {
+        thread_create("cleaner", PRI_DEFAULT, cleaner_thread, NULL);
+    }
+}
+
+/* Called by the evictor each time it reuses a frame. */
+void
+cleaner_evicted(void)
+{
+    bool wake = false;
+
+    enum intr_level old_level = intr_disable();
+    if (clean_cnt > 0)
+    {
+        clean_cnt--;
+    }
+    if (clean_cnt < low_water && !cleaning)
+    {
+        cleaning = wake = true;
+    }
+    intr_set_level(old_level);
+
+    if (wake)
+    {
+        sema_up(&cleaner_sema);
+    }
+}
+
+static void
+cleaner_thread(void *aux UNUSED)
+{
+    while (true)
+    {
+        sema_down(&cleaner_sema);
+        size_t cnt = clean_ahead();
+
+        enum intr_level old_level = intr_disable();
+        clean_cnt = cnt;
+        cleaning = false;
+        intr_set_level(old_level);
+    }
+}
+
+/* Pages picked for cleaning, written together by flush_batch() */
+struct clean_batch {
+    size_t cnt;
+    struct clean_page {
+        struct thread *t;
+        void *upage;
+        void *kva;
+        struct spt_entry *spe;
+        bool locked;        /* spt_lock of T taken for this page */
+    } pages[SWAP_CLUSTER];
+};
+
+/* Walks the frames ahead of the clock hand, cleaning dirty ones,
+   until high_water of them are free or clean or every frame has
+   been seen.  Dirty frames are gathered into batches so that
+   pages evicted together are written side by side in swap with a
+   single request.  Returns the number found free or clean. */
+static size_t
+clean_ahead(void)
+{
+    size_t cnt = frame_count();
+    size_t idx = frame_hand();
+    size_t clean = 0;
+    struct clean_batch b;
+    b.cnt = 0;
+
+    for (size_t i = 0; i < cnt && clean < high_water; i++)
+    {
+        struct frame_entry *fe = frame_lock_index(idx);
+        if (fe == NULL || clean_frame(fe, &b))
+        {
+            clean++;
+        }
+        if (b.cnt == SWAP_CLUSTER)
+        {
+            clean -= flush_batch(&b);
+        }
+        idx = (idx + 1) % cnt;
+    }
+    clean -= flush_batch(&b);
+    return clean;
+}
+
+/* Returns true if frame FE, whose shard is locked, is clean or
+   has been added to batch B for cleaning.  Releases the shard. */
+static bool
+clean_frame(struct frame_entry *fe, struct clean_batch *b)
+{
+    /* Frames being filled or evicted are left alone.  Shared
+       frames are read-only file pages, always clean, or pages
+       shared copy-on-write, which every owner has to save to a
+       slot of its own and so are left to the evictor. */
+    if (fe->pinned || fe->owners_list_size != 1)
+    {
+        bool clean = !fe->pinned;
+        frame_release(fe);
+        return clean;
+    }
+
+    struct owner *o = &fe->first_owner;
+    uint32_t *pd = o->t->pagedir;
+    if (pd == NULL || !pagedir_is_dirty(pd, o->upage))
+    {
+        frame_release(fe);
+        return pd != NULL;
+    }
+
+    /* The owner's spt_lock keeps it from exiting or evicting the
+       page under us; never wait for it while holding the shard.
+       An earlier page of the batch may already hold it. */
+    bool locked = false;
+    if (!lock_held_by_current_thread(&o->t->spt_lock))
+    {
+        if (!lock_try_acquire(&o->t->spt_lock))
+        {
+            frame_release(fe);
+            return false;
+        }
+        locked = true;
+    }
+    struct spt_entry *spe = find_spe(&o->t->sp_table, o->upage);
+    if (spe == NULL || !spe->writable)
+    {
+        /* Memory mapped pages are written back by the evictor */
+        if (locked)
+        {
+            lock_release(&o->t->spt_lock);
+        }
+        frame_release(fe);
+        return false;
+    }
+    fe->pinned = true;
+
+    struct clean_page *p = &b->pages[b->cnt++];
+    p->t = o->t;
+    p->upage = o->upage;
+    p->kva = fe->kva;
+    p->spe = spe;
+    p->locked = locked;
+    frame_release(fe);
+
+    /* Clear the dirty bit before copying, so that a write racing
+       with the copy marks the page dirty again */
+    pagedir_set_dirty(pd, p->upage, false);
+    return true;
+}
+
+/* Writes the pages of batch B to swap, records their slots and
+   lets them go.  Returns the number that could not be written,
+   which are left dirty. */
+static size_t
+flush_batch(struct clean_batch *b)
+{
+    const void *pages[SWAP_CLUSTER];
+    size_t slots[SWAP_CLUSTER];
+    size_t failed = 0;
+    size_t i;
+
+    for (i = 0; i < b->cnt; i++)
+    {
+        pages[i] = b->pages[i].kva;
+    }
+    swap_out_cluster(pages, b->cnt, slots);
+
+    for (i = 0; i < b->cnt; i++)
+    {
+        struct clean_page *p = &b->pages[i];
+        if (p->spe->clean_slot != NO_SWAP_SLOT)
+        {
+            swap_drop(p->spe->clean_slot);
+        }
+        p->spe->clean_slot = slots[i];
+        if (slots[i] == NO_SWAP_SLOT)
+        {
+            pagedir_set_dirty(p->t->pagedir, p->upage, true);
+            failed++;
+        }
+    }
+
+    /* Unlock only after every page of the batch is recorded, as
+       pages of one process share its spt_lock */
+    for (i = 0; i < b->cnt; i++)
+    {
+        struct clean_page *p = &b->pages[i];
+        if (p->locked)
+        {
+            lock_release(&p->t->spt_lock);
+        }
+        unpin_frame(p->kva);
+    }
+    b->cnt = 0;
+    return failed;
+}
@@ -0,0 +1,14 @@
+#ifndef CLEANER_H
+#define CLEANER_H
+
+#include <stddef.h>
+
+/* Default watermarks, in frames, for the page cleaner.  Overridden
+   by the -cl and -ch kernel command line options. */
+#define CLEANER_LOW_DEFAULT 8
+#define CLEANER_HIGH_DEFAULT 32
+
+void cleaner_init(size_t low_water, size_t high_water);
+void cleaner_evicted(void);
+
+#endif /* vm/cleaner.h */
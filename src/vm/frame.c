@@ -1,145 +1,371 @@
 #include "threads/malloc.h"
-#include "lib/kernel/hash.h"
+#include "threads/palloc.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
 #include "userprog/pagedir.h"
 #include "frame.h"
+#include <round.h>
 #include <stdio.h>
 
-static hash_hash_func frame_hash_func;  // hash function for frame table
-static hash_less_func frame_less_func;  // hash less function for frame table
+/* One descriptor per user pool frame, indexed by
+   (kva - frames_base) / PGSIZE.  The array lives in kernel pool
+   pages allocated once at boot. */
+static struct frame_entry *frames;
+static size_t frame_cnt;
+static uint8_t *frames_base;
 
-static hash_action_func frame_destroy_func;
+/* Locks striped over the frame array: frame i is guarded by
+   shard_locks[i % FRAME_SHARDS], which covers every field of its
+   frame_entry, so faults on unrelated frames do not contend. */
+static struct lock shard_locks[FRAME_SHARDS];
 
-bool
-generate_frame_table(struct hash *frame_table) 
+/* Owners of shared frames beyond the first */
+static struct kmem_cache *owner_cache;
+
+/* index of the SECOND-CHANCE EVICTION clock hand */
+static size_t hand;
+
+/* synchronising hand accesses; always taken before any shard lock */
+static struct lock clock_lock;
+
+static bool lock_owners(struct frame_entry *fe);
+
+static size_t
+frame_index(const void *kva)
 {
-    return hash_init(frame_table, frame_hash_func, frame_less_func, NULL);
+    return ((const uint8_t *) kva - frames_base) / PGSIZE;
 }
 
-void 
-insert_frame(struct hash *frame_table,
-             struct list *queue,
-             struct frame_entry *frame)
+static struct lock *
+shard_lock(size_t idx)
 {
-    struct hash_elem *he = hash_insert(frame_table, &frame->elem);
-    ASSERT(!he);
-    list_push_back(queue, &frame->l_elem);
+    return &shard_locks[idx % FRAME_SHARDS];
+}
+
+/* Sets up descriptors for the PAGE_CNT frames of the user pool
+   starting at BASE. */
+void
+frame_init(void *base, size_t page_cnt)
+{
+    size_t pages = DIV_ROUND_UP(page_cnt * sizeof *frames, PGSIZE);
+    frames = page_cnt > 0
+        ? palloc_get_multiple(PAL_ASSERT | PAL_ZERO, pages) : NULL;
+    frame_cnt = page_cnt;
+    frames_base = base;
+    for (size_t i = 0; i < frame_cnt; i++)
+    {
+        list_init(&frames[i].more_owners);
+    }
+    for (int i = 0; i < FRAME_SHARDS; i++)
+    {
+        lock_init(&shard_locks[i]);
+    }
+    hand = 0;
+    lock_init(&clock_lock);
+    owner_cache = kmem_cache_create("owner", sizeof(struct owner), NULL);
 }
 
+/* Marks the newly allocated frame KVA as in use.  The frame
+   starts out pinned, so it cannot be evicted before its new owner
+   has filled and installed it. */
+void
+insert_frame(void *kva)
+{
+    size_t idx = frame_index(kva);
+    ASSERT(idx < frame_cnt);
+    struct frame_entry *fe = &frames[idx];
+
+    lock_acquire(shard_lock(idx));
+    ASSERT(fe->kva == NULL);
+    fe->kva = kva;
+    fe->pinned = true;
+    fe->owners_list_size = 0;
+    fe->share_entry = NULL;
+    lock_release(shard_lock(idx));
+}
+
+/* Chooses a frame to evict with the second-chance algorithm.
+   Free and pinned frames and frames whose owners are busy in
+   their own supplemental page table are passed over.  The victim
+   is returned pinned and with every owner's spt_lock held (see
+   owner->locked), so its owners cannot fault it back in or exit
+   while the caller writes it out.  Returns NULL if there are no
+   user frames at all. */
 struct frame_entry *
-evict_frame(struct list *queue,
-            struct list_elem **index)
-{
-    struct frame_entry *fe;
-    struct list_elem *e;
-    if (*index == list_end(queue)) {
-        *index = list_begin(queue);
-        if (*index == list_end(queue)) {
-            return NULL;
-        }
+evict_frame(void)
+{
+    struct frame_entry *fe = NULL;
+
+    if (frame_cnt == 0)
+    {
+        return NULL;
     }
+
+    lock_acquire(&clock_lock);
+
+    /* Two full sweeps clear every accessed bit, so failing to
+       find a victim after that means every frame is busy: let
+       the threads holding them make progress and try again. */
+    size_t budget = 2 * frame_cnt + 1;
     while (true)
-    {   
+    {
+        if (budget-- == 0)
+        {
+            lock_release(&clock_lock);
+            thread_yield();
+            lock_acquire(&clock_lock);
+            budget = 2 * frame_cnt + 1;
+        }
+
+        size_t idx = hand;
+        hand = (hand + 1) % frame_cnt;
+        fe = &frames[idx];
+
+        lock_acquire(shard_lock(idx));
+        if (fe->kva == NULL || fe->pinned)
+        {
+            lock_release(shard_lock(idx));
+            continue;
+        }
+
         bool rr = false;
-        fe = list_entry(*index, struct frame_entry, l_elem);
-        for (e = list_begin(&fe->owners);
-             e != list_end(&fe->owners);
-             e = list_next(e))
-        {   
-            struct owner *frame_owner = list_entry(e, struct owner, elem);
-            if (frame_owner->t->pagedir)
+        struct owner *o;
+        for (o = frame_first_owner(fe); o; o = frame_next_owner(fe, o))
+        {
+            if (o->t->pagedir)
             {
-                rr |= 
-                    pagedir_is_accessed(frame_owner->t->pagedir, frame_owner->upage);
-                pagedir_set_accessed(frame_owner->t->pagedir, 
-                                    frame_owner->upage,
-                                    false);
-
+                rr |= pagedir_is_accessed(o->t->pagedir, o->upage);
+                pagedir_set_accessed(o->t->pagedir, o->upage, false);
             }
         }
-        get_next(index, queue);
-        // printf("index:%p\n", *index);
-        if (!rr)
+
+        if (!rr && lock_owners(fe))
         {
+            fe->pinned = true;
+            lock_release(shard_lock(idx));
             break;
         }
+        lock_release(shard_lock(idx));
     }
-    // printf("size return %d\n", fe->owners_list_size);
+    lock_release(&clock_lock);
     return fe;
+}
 
+/* Marks frame KVA as no longer in use.  It must have no owners. */
+void
+free_frame(void *kva)
+{
+    size_t idx = frame_index(kva);
+    ASSERT(idx < frame_cnt);
+    struct frame_entry *fe = &frames[idx];
+
+    lock_acquire(shard_lock(idx));
+    ASSERT(fe->kva == kva);
+    ASSERT(fe->owners_list_size == 0);
+    fe->kva = NULL;
+    fe->pinned = false;
+    lock_release(shard_lock(idx));
+}
+
+/* Returns the entry for frame KPAGE with its shard locked, or
+   NULL if KPAGE is not an allocated user frame.  Release with
+   frame_release(). */
+struct frame_entry *
+find_frame_entry(void *kpage)
+{
+    size_t idx = frame_index(kpage);
+    if ((uint8_t *) kpage < frames_base || idx >= frame_cnt)
+    {
+        return NULL;
+    }
+
+    lock_acquire(shard_lock(idx));
+    if (frames[idx].kva != kpage)
+    {
+        lock_release(shard_lock(idx));
+        return NULL;
+    }
+    return &frames[idx];
 }
 
+/* Returns the entry for the IDXth user frame with its shard
+   locked, or NULL if that frame is not allocated.  Lets callers
+   walk the frames in clock order, see frame_hand(). */
+struct frame_entry *
+frame_lock_index(size_t idx)
+{
+    ASSERT(idx < frame_cnt);
+    lock_acquire(shard_lock(idx));
+    if (frames[idx].kva == NULL)
+    {
+        lock_release(shard_lock(idx));
+        return NULL;
+    }
+    return &frames[idx];
+}
+
+/* Number of frames in the user pool. */
+size_t
+frame_count(void)
+{
+    return frame_cnt;
+}
+
+/* Index of the next frame the clock will consider for eviction. */
+size_t
+frame_hand(void)
+{
+    return hand;
+}
+
+void
+frame_release(struct frame_entry *fe)
+{
+    lock_release(shard_lock(fe - frames));
+}
+
+/* Makes frame KPAGE a candidate for eviction again. */
+void
+unpin_frame(void *kpage)
+{
+    struct frame_entry *fe = find_frame_entry(kpage);
+    ASSERT(fe);
+    fe->pinned = false;
+    frame_release(fe);
+}
+
+/* Records T's mapping of FE at UPAGE.  Only owners beyond the
+   first need memory.  The shard of FE must be locked. */
 bool
-free_frame(struct hash *frame_table,
-           struct list *queue,
-           void *kva, 
-           struct list_elem **index)
-{   
-    struct frame_entry fake_frame;
-    fake_frame.kva = kva;
-    struct hash_elem *he = hash_delete(frame_table, &fake_frame.elem);
-    if (he != NULL)
-    {
-        // mathced an entry
-        struct frame_entry *fe = hash_entry(he, struct frame_entry, elem);
-        if (*index == &fe->l_elem)
+frame_add_owner(struct frame_entry *fe, struct thread *t, void *upage)
+{
+    struct owner *o = &fe->first_owner;
+    if (fe->owners_list_size > 0)
+    {
+        o = kmem_cache_alloc(owner_cache);
+        if (o == NULL)
         {
-            get_next(index, queue);
+            return false;
         }
-        list_remove(&fe->l_elem);
-        free(fe);
-        return true;
+        list_push_back(&fe->more_owners, &o->elem);
     }
-    return false;
+    o->t = t;
+    o->upage = upage;
+    o->locked = false;
+    fe->owners_list_size++;
+    return true;
 }
 
-struct frame_entry *find_frame_entry(struct hash *frame_table, void *kpage) {
-    struct frame_entry fake_fentry;
-    fake_fentry.kva = kpage;
-    return hash_entry(hash_find(frame_table, &fake_fentry.elem), struct frame_entry, elem);
+/* Forgets T's mapping of FE and returns the user page it was
+   mapped at, or NULL if T is not an owner.  The shard of FE must
+   be locked. */
+void *
+frame_remove_owner(struct frame_entry *fe, struct thread *t)
+{
+    struct owner *o;
+    for (o = frame_first_owner(fe); o; o = frame_next_owner(fe, o))
+    {
+        if (o->t == t)
+        {
+            break;
+        }
+    }
+    if (o == NULL)
+    {
+        return NULL;
+    }
+
+    void *upage = o->upage;
+    if (o == &fe->first_owner && !list_empty(&fe->more_owners))
+    {
+        /* Move an overflow owner into the inline slot */
+        o = list_entry(list_pop_front(&fe->more_owners), struct owner, elem);
+        fe->first_owner = *o;
+        kmem_cache_free(owner_cache, o);
+    }
+    else if (o != &fe->first_owner)
+    {
+        list_remove(&o->elem);
+        kmem_cache_free(owner_cache, o);
+    }
+    fe->owners_list_size--;
+    return upage;
 }
-    
 
-static unsigned frame_hash_func(const struct hash_elem *e, void *aux UNUSED)
+/* Forgets every owner of FE. */
+void
+frame_clear_owners(struct frame_entry *fe)
 {
-    return ((unsigned) (hash_entry(e, struct frame_entry, elem) -> kva));
+    while (!list_empty(&fe->more_owners))
+    {
+        kmem_cache_free(owner_cache,
+                        list_entry(list_pop_front(&fe->more_owners),
+                                   struct owner, elem));
+    }
+    fe->owners_list_size = 0;
 }
 
-static bool frame_less_func (const struct hash_elem *a, 
-                             const struct hash_elem *b, 
-                             void *aux UNUSED)
+/* Iteration over the owners of FE:
+   for (o = frame_first_owner(fe); o; o = frame_next_owner(fe, o)) */
+struct owner *
+frame_first_owner(struct frame_entry *fe)
 {
-    return (hash_entry(a, struct frame_entry, elem) -> kva) 
-        < (hash_entry(b, struct frame_entry, elem) -> kva);
+    return fe->owners_list_size > 0 ? &fe->first_owner : NULL;
 }
 
-void destroy_frame_table(struct hash *frame_table)
+struct owner *
+frame_next_owner(struct frame_entry *fe, struct owner *o)
 {
-    hash_destroy(frame_table, frame_destroy_func);
+    struct list_elem *e = o == &fe->first_owner
+        ? list_begin(&fe->more_owners) : list_next(&o->elem);
+    return e != list_end(&fe->more_owners)
+        ? list_entry(e, struct owner, elem) : NULL;
 }
 
-static void frame_destroy_func (struct hash_elem *e, void *aux UNUSED)
+/* Tries to take the spt_lock of every owner of FE without
+   blocking, since the caller already holds locks that an owner
+   may be waiting on.  Returns false, holding none of them, if
+   any owner is busy. */
+static bool
+lock_owners(struct frame_entry *fe)
 {
-    free(hash_entry(e, struct frame_entry, elem));
+    struct owner *o;
+    for (o = frame_first_owner(fe); o; o = frame_next_owner(fe, o))
+    {
+        o->locked = false;
+        if (lock_held_by_current_thread(&o->t->spt_lock))
+        {
+            continue;
+        }
+        if (!lock_try_acquire(&o->t->spt_lock))
+        {
+            unlock_owners(fe);
+            return false;
+        }
+        o->locked = true;
+    }
+    return true;
 }
 
+/* Releases the spt_locks that evict_frame() took on FE's owners. */
 void
-get_next(struct list_elem **index, struct list *queue_pt)
-{   
-    // edge case when tail at start
-    if (list_end(queue_pt) == *index)
+unlock_owners(struct frame_entry *fe)
+{
+    struct owner *o;
+    for (o = frame_first_owner(fe); o; o = frame_next_owner(fe, o))
     {
-        *index = list_begin(queue_pt);
-        return;
+        if (o->locked)
+        {
+            o->locked = false;
+            lock_release(&o->t->spt_lock);
+        }
     }
-    
-    // move the index along
-    *index = list_next(*index);
-    
-    // check circular fashion
-    if (list_end(queue_pt) == *index)
+}
+
+void destroy_frame_table(void)
+{
+    for (size_t i = 0; i < frame_cnt; i++)
     {
-        *index = list_begin(queue_pt);
+        frame_clear_owners(&frames[i]);
     }
-    ASSERT (*index);
-}
\ No newline at end of file
+}
@@ -1,35 +1,50 @@
 #ifndef FRAME_H
 #define FRAME_H
 
-#include "lib/kernel/hash.h"
+#include <stddef.h>
+#include "lib/kernel/list.h"
+#include "threads/synch.h"
 
-struct frame_entry {
-    uint32_t *kva;
-    struct list owners;
-    unsigned owners_list_size;
-    struct inner_share_entry *inner_entry;
-    struct hash_elem elem;
-    struct list_elem l_elem;
-};
+/* Number of locks striped across the frame table. */
+#define FRAME_SHARDS 8
 
 struct owner {
     struct thread *t;
     void *upage;
+    bool locked;            /* spt_lock of T taken by the evictor */
     struct list_elem elem;
 };
 
-bool generate_frame_table(struct hash *frame_table);
-struct frame_entry *find_frame_entry(struct hash *frame_table, void *kva);
-void insert_frame(struct hash *frame_table,
-                  struct list *queue,
-                  struct frame_entry *frame);
-bool free_frame(struct hash *frame_table, 
-                struct list *queue,
-                void *kva, 
-                struct list_elem **index);
-struct frame_entry *evict_frame(struct list *queue,
-                                struct list_elem **index);
-void destroy_frame_table(struct hash *frame_table);
-void get_next(struct list_elem **index, struct list *queue_pt);
+/* Descriptor of one user pool frame, kept in a flat array indexed
+   by the frame's position in the pool.  Most frames have a single
+   owner, which is stored inline; only shared frames malloc the
+   rest into more_owners. */
+struct frame_entry {
+    uint32_t *kva;          /* NULL while the frame is not allocated */
+    bool pinned;            /* Being filled or evicted, not evictable */
+    unsigned owners_list_size;
+    struct owner first_owner;
+    struct list more_owners;
+    struct share_entry *share_entry;    /* Published in share_table */
+};
+
+void frame_init(void *base, size_t page_cnt);
+struct frame_entry *find_frame_entry(void *kva);
+struct frame_entry *frame_lock_index(size_t idx);
+void frame_release(struct frame_entry *fe);
+size_t frame_count(void);
+size_t frame_hand(void);
+void insert_frame(void *kva);
+void free_frame(void *kva);
+struct frame_entry *evict_frame(void);
+void unlock_owners(struct frame_entry *fe);
+void unpin_frame(void *kva);
+void destroy_frame_table(void);
+
+bool frame_add_owner(struct frame_entry *fe, struct thread *t, void *upage);
+void *frame_remove_owner(struct frame_entry *fe, struct thread *t);
+void frame_clear_owners(struct frame_entry *fe);
+struct owner *frame_first_owner(struct frame_entry *fe);
+struct owner *frame_next_owner(struct frame_entry *fe, struct owner *o);
 
-#endif /* vm/frame.h */
\ No newline at end of file
+#endif /* vm/frame.h */
@@ -22,6 +22,15 @@ static bool file_mmap_less_func (const struct hash_elem *a,
 static int allocate_mapid (struct thread *current);
 static void mmap_entry_free_func (struct hash_elem *e, void *aux UNUSED);
 
+/* One page_mmap_entry per mapped page */
+static struct kmem_cache *pentry_cache;
+
+void mmap_init(void)
+{
+    pentry_cache = kmem_cache_create("page_mmap_entry",
+                                     sizeof(struct page_mmap_entry), NULL);
+}
+
 bool generate_mmap_tables(struct hash *page_mmap_table,
                           struct hash *file_mmap_table)
 {
@@ -48,19 +57,16 @@ mapid_t insert_mmap(struct hash *page_mmap_table, struct hash *file_mmap_table,
 {
     struct file_mmap_entry *fentry = malloc(sizeof(struct file_mmap_entry));
 
-    lock_acquire(&file_lock);
     fentry->mapping = allocate_mapid(thread_current());
     fentry->file_pt = file_reopen(fd_obj->file_pt);
-    strlcpy(fentry->file_name, fd_obj->file_name, MAX_FILE_NAME_SIZE);
     unsigned flength = file_length(fd_obj->file_pt);
-    lock_release(&file_lock);
 
     struct list *map_entries = malloc(sizeof(struct list));
     list_init(map_entries);
 
     unsigned last_page = (unsigned) pg_round_down(uaddr + flength);
     for (unsigned i = (unsigned) uaddr; i <= last_page; i += PGSIZE) {
-        struct page_mmap_entry *pentry = malloc(sizeof(struct page_mmap_entry));
+        struct page_mmap_entry *pentry = kmem_cache_alloc(pentry_cache);
         pentry->uaddr = (void *) i;
         pentry->fentry = fentry;
         pentry->offset = i - (unsigned) uaddr;
@@ -85,27 +91,32 @@ void unmap_entry(struct hash *page_mmap_table, struct hash *file_mmap_table,
         ASSERT(hash_delete(page_mmap_table, &pentry->helem));      
         if (pagedir_is_dirty (thread_current ()->pagedir, pentry->uaddr))
         {
-            struct file *fp = pentry->fentry->file_pt;
-            lock_acquire(&file_lock);
-            file_seek (fp, pentry->offset);
-            unsigned flength = file_length(fentry->file_pt);
-            file_write (fp, pagedir_get_page(thread_current()->pagedir, pentry->uaddr),
-               flength - pentry->offset >= PGSIZE ? PGSIZE : flength - pentry->offset);
-            lock_release(&file_lock);
+            mmap_write_back(pentry,
+                pagedir_get_page(thread_current()->pagedir, pentry->uaddr));
         }
         e = list_next(e);
-        free(pentry);
+        kmem_cache_free(pentry_cache, pentry);
     }
     if (delete_from_table) {
         hash_delete(file_mmap_table, &fentry->elem);
     }
-    lock_acquire(&file_lock);
     file_close(fentry->file_pt);
-    lock_release(&file_lock);
     free(fentry->page_mmap_entries);
     free(fentry);
 }
 
+/* Writes the memory mapped page PENTRY, held in frame KPAGE, back
+   to its file.  Also used by the evictor, on behalf of another
+   process, so the file position is left alone. */
+void mmap_write_back(struct page_mmap_entry *pentry, void *kpage)
+{
+    struct file *fp = pentry->fentry->file_pt;
+    unsigned flength = file_length(fp);
+    file_write_at (fp, kpage,
+       flength - pentry->offset >= PGSIZE ? PGSIZE : flength - pentry->offset,
+       pentry->offset);
+}
+
 /* Destroys all mmap tables for the current thread */
 void destroy_mmap_tables(void)
 {
@@ -113,6 +124,62 @@ void destroy_mmap_tables(void)
     hash_clear(&t->file_mmap_table, mmap_entry_free_func);
 }
 
+/* Gives the current thread, forked from PARENT, the mappings of
+   PARENT: the same files at the same addresses under the same
+   ids.  No page is copied, since mapped pages are shared by file
+   page; the child finds those PARENT has in memory on first
+   access.  Returns false if out of memory, leaving what was
+   copied for destroy_mmap_tables(). */
+bool copy_mmap_tables(struct thread *parent)
+{
+    struct thread *t = thread_current();
+    struct hash_iterator i;
+
+    t->mapid_next = parent->mapid_next;
+    hash_first(&i, &parent->file_mmap_table);
+    while (hash_next(&i))
+    {
+        struct file_mmap_entry *pfentry 
+            = hash_entry(hash_cur(&i), struct file_mmap_entry, elem);
+        struct file_mmap_entry *fentry 
+            = malloc(sizeof(struct file_mmap_entry));
+        struct list *map_entries = malloc(sizeof(struct list));
+        struct file *fp = file_reopen(pfentry->file_pt);
+        if (fentry == NULL || map_entries == NULL || fp == NULL)
+        {
+            free(fentry);
+            free(map_entries);
+            file_close(fp);
+            return false;
+        }
+        fentry->mapping = pfentry->mapping;
+        fentry->file_pt = fp;
+        list_init(map_entries);
+        fentry->page_mmap_entries = map_entries;
+        hash_insert(&t->file_mmap_table, &fentry->elem);
+
+        struct list_elem *e;
+        for (e = list_begin(pfentry->page_mmap_entries);
+             e != list_end(pfentry->page_mmap_entries);
+             e = list_next(e))
+        {
+            struct page_mmap_entry *ppentry 
+                = list_entry(e, struct page_mmap_entry, lelem);
+            struct page_mmap_entry *pentry = kmem_cache_alloc(pentry_cache);
+            if (pentry == NULL)
+            {
+                return false;
+            }
+            pentry->uaddr = ppentry->uaddr;
+            pentry->fentry = fentry;
+            pentry->offset = ppentry->offset;
+            list_push_back(map_entries, &pentry->lelem);
+            hash_insert(&t->page_mmap_table, &pentry->helem);
+        }
+    }
+    return true;
+}
+
 static void mmap_entry_free_func (struct hash_elem *e, void *aux UNUSED)
 {
     struct thread *t = thread_current();
@@ -6,6 +6,8 @@
 #include "lib/kernel/hash.h"
 #include "userprog/syscall.h"
 
+struct thread;
+
 struct page_mmap_entry {
     void *uaddr;
     struct file_mmap_entry *fentry;
@@ -17,11 +19,11 @@ struct page_mmap_entry {
 struct file_mmap_entry {
     mapid_t mapping;
     struct file *file_pt; 
-    char file_name[MAX_FILE_NAME_SIZE];
     struct list *page_mmap_entries;
     struct hash_elem elem;
 };
 
+void mmap_init(void);
 bool generate_mmap_tables(struct hash *page_mmap_table,\
                           struct hash *file_mmap_table);
 /* Returns NULL if not upage not found */
@@ -30,6 +32,8 @@ mapid_t insert_mmap(struct hash *page_mmap_table, struct hash *file_mmap_table,
                     void *uaddr, struct fd_st *fd_obj);
 void unmap_entry(struct hash *page_mmap_table, struct hash *file_mmap_table,
                  struct file_mmap_entry *fentry, bool delete_from_table);
+void mmap_write_back(struct page_mmap_entry *pentry, void *kpage);
 void destroy_mmap_tables(void);
+bool copy_mmap_tables(struct thread *parent);
 
 #endif /* vm/mmap.h */
\ No newline at end of file
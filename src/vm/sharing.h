@@ -2,34 +2,44 @@
 #define SHARING_H
 
 #include "lib/kernel/hash.h"
+#include "devices/block.h"
 
-#define MAX_FILE_NAME_SIZE 14
+struct file;
 
-struct outer_share_entry {
-    char *file_name;
-    unsigned int hash_val;
-    unsigned int size;
-    struct hash inner_sharing_table;
-    struct hash_elem elem;
-};
+/* Page number under which the page of an executable at user
+   address UPAGE is shared.  Keyed by address rather than by file
+   page, which is how mapped files are shared: the first data page
+   may come from the same file page as the last code page, and a
+   program may map its own executable. */
+#define SHARE_EXEC_PAGE(UPAGE) (pg_no (UPAGE) | 0x80000000u)
 
-struct inner_share_entry {
+/* Names page PAGE_NUM of the file whose inode is at SECTOR, as its
+   contents were at VERSION, see inode_version(). */
+struct share_key {
+    block_sector_t sector;
     unsigned page_num;
+    unsigned version;
+};
+
+/* A frame holding a page of a file, which processes mapping that
+   page can share.  Entries are unique by sector and page number;
+   an entry whose version is older than its file's is stale. */
+struct share_entry {
+    struct share_key key;
     void *kpage;
     struct hash_elem elem;
-    struct outer_share_entry *outer_entry;
 };
 
-
-unsigned calculate_hash_val(char *file_name);
+void share_key_init(struct share_key *key, struct file *file,
+                    unsigned page_num);
 bool generate_sharing_table(struct hash *sharing_table);
-struct inner_share_entry * 
-insert_sharing_entry(struct hash *sharing_table, 
-                     char *file_name, 
-                     unsigned page_num, 
-                     void *kpage);
-void *find_sharing_entry(struct hash *sharing_table, char *file_name, unsigned page_num);
-bool delete_sharing_frame(struct hash *sharing_table, struct inner_share_entry *isentry);
+struct share_entry *insert_sharing_entry(struct hash *sharing_table,
+                                         const struct share_key *key,
+                                         void *kpage);
+struct share_entry *find_sharing_entry(struct hash *sharing_table,
+                                       const struct share_key *key);
+void delete_sharing_frame(struct hash *sharing_table,
+                          struct share_entry *entry);
 void destroy_share_table(struct hash *share_table);
 
-#endif /* vm/sharing.h */ 
\ No newline at end of file
+#endif /* vm/sharing.h */
@@ -8,6 +8,14 @@ static hash_hash_func spt_hash_func;  // hash function for frame table
 static hash_less_func spt_less_func;  // hash less function for frame table
 static hash_action_func spt_destroy_func;  // hash less function for frame table
 
+struct kmem_cache *spe_cache;
+
+void
+spt_init(void)
+{
+    spe_cache = kmem_cache_create("spt_entry", sizeof(struct spt_entry), NULL);
+}
+
 bool 
 generate_spt_table(struct hash *spt_table)
 {
@@ -35,7 +43,7 @@ free_entry(struct hash *spt_table, void *upage)
     fake_spe.upage = upage;
     struct hash_elem *he = hash_delete(spt_table, &fake_spe.elem);
     ASSERT(he);
-    free(hash_entry(he, struct spt_entry, elem));
+    kmem_cache_free(spe_cache, hash_entry(he, struct spt_entry, elem));
 }
 
 void update_spe(struct spt_entry *old_spe, struct spt_entry *new_spe)
@@ -68,7 +76,15 @@ destroy_spt_table(struct hash *spt_table)
 static void spt_destroy_func (struct hash_elem *e, void *aux UNUSED)
 {   
     struct spt_entry *spe = hash_entry(e, struct spt_entry, elem);
-    free(spe);
+    if (spe->location == SWAP_SLOT)
+    {
+        swap_drop(spe->swap_slot);
+    }
+    if (spe->clean_slot != NO_SWAP_SLOT)
+    {
+        swap_drop(spe->clean_slot);
+    }
+    kmem_cache_free(spe_cache, spe);
 }
 
 static unsigned spt_hash_func(const struct hash_elem *e, void *aux UNUSED)
@@ -4,6 +4,9 @@
 #include "lib/kernel/hash.h"
 #include "filesys/off_t.h"
 
+/* Value of swap_slot and clean_slot when no slot is held */
+#define NO_SWAP_SLOT ((size_t) -1)
+
 enum data_location_flags
   {   
     SWAP_SLOT,      
@@ -20,6 +23,8 @@ struct spt_entry {
     size_t page_read_bytes;    // loading
 
     size_t swap_slot;         // slot of swapped out page
+    size_t clean_slot;        // slot with a copy of the resident page,
+                              // written by the page cleaner
 
     enum data_location_flags location; // location of data to be loaded
     enum data_location_flags location_prev; // location of data before it was swapped
@@ -28,6 +33,10 @@ struct spt_entry {
     struct hash_elem elem; // to make part of spt
 };
 
+/* Cache the spt_entries of every process are allocated from */
+extern struct kmem_cache *spe_cache;
+
+void spt_init(void);
 bool generate_spt_table(struct hash *spt_table);
 struct hash_elem * insert_spe(struct hash *spt_table, struct spt_entry *spe);
 void update_spe(struct spt_entry *old_spe, struct spt_entry *new_spe);